@@ -17,9 +17,23 @@
 #include <unistd.h>
 #include <signal.h>
  
-#define BUFFERSIZE 4096 
+// the buffer is sized to the file, within these limits
+#define MIN_BUFFERSIZE (64 * 1024)
+#define MAX_BUFFERSIZE (8 * 1024 * 1024)
   
   
+/// PICK_BUFFER_SIZE ///
+size_t pick_buffer_size(struct stat *s) {
+	// big enough to read a small file in one go, and a whole number of the file's blocks
+	size_t block = s->st_blksize > 0 ? s->st_blksize : 4096;
+	size_t size = (s->st_size + block - 1) / block * block;
+
+	if (size > MAX_BUFFERSIZE) size = MAX_BUFFERSIZE / block * block;
+	if (size < MIN_BUFFERSIZE) size = MIN_BUFFERSIZE;
+	return size;
+}
+
+
 /// DISPLAY_MESSAGE ///
 void display_message(int s) {
 	// print message
@@ -69,6 +83,22 @@ int main (int argc, char **argv) {
 		exit(1);
 	} 
 	 
+	// size the buffer from the source file
+	struct stat s;
+	if (fstat(fileno(srcF), &s) != 0) {
+		printf("%s: %s: %s\n", argv[0], argv[1], strerror(errno));
+		exit(1);
+	}
+	size_t bufferSize = pick_buffer_size(&s);
+	char *buffer = malloc(bufferSize);
+	if (buffer == NULL) {
+		printf("%s: Malloc error: %s\n", argv[0], strerror(errno));
+		exit(1);
+	}
+
+	// the file is read once from start to end, so let the kernel read ahead
+	posix_fadvise(fileno(srcF), 0, 0, POSIX_FADV_SEQUENTIAL);
+	 
 	int stillReading = 1;
 	int totalBytes = 0;
 	
@@ -77,13 +107,12 @@ int main (int argc, char **argv) {
  
 	//enter loop for reading and copying file
 	while (stillReading) {
-		char buffer[BUFFERSIZE];
 		int justRead = 0;
 		int tryAgain;
 		
-		// read from max of BUFFERSIZE bytes from sourceFile
+		// read from max of bufferSize bytes from sourceFile
 		do {
-			justRead = fread(buffer, sizeof(char), BUFFERSIZE, srcF);
+			justRead = fread(buffer, sizeof(char), bufferSize, srcF);
 			if (justRead >= 0) tryAgain = 0;	// successful read
 			else if (errno == EINTR) tryAgain = 1;	//read failed because of an interrupt
 			else {		//read failed for a fatal reason and prog should exit with error message
@@ -111,6 +140,10 @@ int main (int argc, char **argv) {
 			totalBytes += justRead;
 		}
 	}
+	free(buffer);
+
+	// done with the source, so don't let it crowd other data out of the page cache
+	posix_fadvise(fileno(srcF), 0, 0, POSIX_FADV_DONTNEED);
 	 
 	 // close sourceFile, check for error closing
 	if (fclose(srcF) < 0){
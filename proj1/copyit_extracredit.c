@@ -6,6 +6,8 @@
  * recurively into the destination directory.  The source and destination directory are
  * identified by the user via command line arguments.
  */
+
+#define _GNU_SOURCE
  
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,38 +21,294 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <linux/falloc.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <poll.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <limits.h>
+#include <sys/xattr.h>
+
+#include "uring.h"
  
-#define BUFFERSIZE 4096
+// read/write buffers are sized to the file, within these limits
+#define MIN_BUFFERSIZE (64 * 1024)
+#define MAX_BUFFERSIZE (8 * 1024 * 1024)
+
+// O_DIRECT needs buffers, offsets and lengths aligned to the device's block size
+#define DIRECT_ALIGN 4096
+// files smaller than this aren't worth bypassing the page cache for
+#define DIRECT_MIN (1024 * 1024)
+
+// largest amount to ask copy_file_range or sendfile for at once
+#define MAX_CHUNK (1024 * 1024 * 1024)
+
+// ways of copying a file, tried in this order until one works (io_uring is only for small files)
+enum engine { ENGINE_CLONE, ENGINE_COPY_RANGE, ENGINE_SENDFILE, ENGINE_READWRITE, ENGINE_URING, ENGINE_DIRECT, ENGINE_PIPELINE, ENGINE_SPARSE, ENGINE_DELTA, NUM_ENGINES };
+const char *engineNames[NUM_ENGINES] = { "clone", "copy_file_range", "sendfile", "read/write", "io_uring", "direct", "pipeline", "sparse", "delta" };
+int engineFiles[NUM_ENGINES];
+
+// bytes of data actually copied, which is less than the file sizes when files have holes
+long long physicalBytes = 0;
+
+// with -i, files that look the same as their copy are skipped, and with -D the rest
+//	are updated in place by rewriting only the blocks that differ
+#define DELTA_BLOCK (64 * 1024)
+int incremental = 0;
+int deltaMode = 0;
+int skippedFiles = 0;
+long long reusedBytes = 0;
+
+// the scan reads each directory with getdents64, this much at a time, into a buffer
+//	per level of the tree.  It builds the paths in place in srcPath and destPath: each
+//	level appends "/name" and cuts it off again, so the paths cost no allocations.
+#define DIRENT_BUFFER (64 * 1024)
+struct linux_dirent64 {
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+char **direntBuffers = NULL;
+int direntLevels = 0;
+char srcPath[PATH_MAX];
+char destPath[PATH_MAX];
+
+// with -a, symlinks and special files are recreated rather than followed or skipped,
+//	later names of a hard-linked file become links to the first copy, and each item's
+//	mode, owner, timestamps and xattrs are recorded by the scan and applied once all
+//	the data is copied.  Those are done in reverse, so a directory is finished (and
+//	maybe made read-only) after everything in it.  What the scan records lives in
+//	an arena that is only freed at the end.
+#define ARENA_CHUNK (1024 * 1024)
+#define LINK_BUCKETS 4096
+struct arenachunk {
+	struct arenachunk *next;
+	size_t used;
+	char data[];
+};
+struct metaentry {
+	char *src;
+	char *dest;
+	struct stat s;
+};
+struct linkentry {		// the first copy of each hard-linked file, by its source inode
+	dev_t dev;
+	ino_t ino;
+	char *dest;
+	struct linkentry *next;
+};
+struct hardlink {		// a later name to link to the first copy
+	char *target;
+	char *dest;
+};
+int archive = 0;
+struct arenachunk *arena = NULL;
+struct metaentry *metadata = NULL;
+int metaCount = 0;
+int metaSize = 0;
+struct linkentry *linkBuckets[LINK_BUCKETS];
+struct hardlink *hardlinks = NULL;
+int linkCount = 0;
+int linkSize = 0;
+
+// with -j, files found by the directory scan are queued here for the worker threads
+#define QUEUE_SIZE 256
+struct copyjob {
+	char src[PATH_MAX];
+	char dest[PATH_MAX];
+};
+struct jobqueue {
+	struct copyjob jobs[QUEUE_SIZE];
+	int head;
+	int count;
+	int done;		// set once the scan is over, so idle workers can exit
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+};
+struct jobqueue queue = { .lock = PTHREAD_MUTEX_INITIALIZER,
+	.notEmpty = PTHREAD_COND_INITIALIZER, .notFull = PTHREAD_COND_INITIALIZER };
+int numWorkers = 0;	// 0 means the scan copies each file itself
+
+// with -u, files up to this size are copied in batches of uringDepth through io_uring
+#define URING_MAX_FILE (64 * 1024)
+#define URING_OPS 5
+struct uringfile {
+	char src[PATH_MAX];
+	char dest[PATH_MAX];
+	off_t size;
+	struct timespec times[2];	// the source's access and modification times
+	char *buffer;
+	struct statx after;	// the source once it has been read, to catch a file that grew
+	int res[URING_OPS];	// results of the open, open, read, write and statx for this file
+};
+struct uring *ring = NULL;
+struct uringfile *batch = NULL;
+int batchCount = 0;
+int uringDepth = 0;
+
+// big files can be copied by a reader thread and a writer thread passing a ring
+//	of buffers, so both files are busy at once.  --direct uses this with O_DIRECT
+//	and at least a pair of aligned buffers, -p with pipelineDepth buffers.
+#define DIRECT_BUFFERS 2
+// files smaller than this don't keep two threads busy long enough to be worth it
+#define PIPELINE_MIN (8 * 1024 * 1024)
+struct pipeline {
+	int srcFd;
+	int destFd;
+	char *srcFile;
+	char *destFile;
+	int direct;		// the buffers are aligned and the files were opened O_DIRECT
+	char **bufs;
+	ssize_t *lens;
+	int nbufs;
+	size_t bufferSize;
+	int filled;		// buffers read and waiting to be written
+	long long totalBytes;	// bytes read, set by the reader when it's done
+	struct copystats *stats;	// of the thread the copy is for
+	int eof;		// set when the reader has filled its last buffer
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+};
+int directMode = 0;
+int pipelineDepth = 0;	// 0 means big files are not pipelined unless --direct is on
+
+// a reporter thread prints the progress every second from these counters.  Each
+//	thread that copies adds to its own copystats: stats[0] is the scan's, and
+//	stats[i] is worker i's.  The pipeline's writer counts for the thread it copies for.
+struct copystats {
+	long long bytes;	// bytes done so far, counted as each chunk is copied
+	int files;		// files done so far
+	long long totalBytes;	// what copyit returned for those files
+};
+struct copystats *stats = NULL;
+__thread struct copystats *myStats = NULL;
+long long scannedBytes = 0;	// size of the files the scan has found so far
+int scannedFiles = 0;
+int scanDone = 0;		// set once scannedBytes is the size of the whole copy
+struct timespec startTime;
+pthread_t reporter;
+int reporterStop = -1;		// eventfd that tells the reporter to finish
 
 /// prototypes	///
-int copyit_recur(char *pathToSrc, char *pathToDest);
-int copyit(char *srcFile, char *destFile);
-void display_message(int s);
+long long copyit_recur(int srcDir, int destDir, int depth);
+long long copyit(int srcDir, char *srcFile, int destDir, char *destFile);
+const char *at_name(int dir, const char *path);
+size_t path_push(char *path, const char *name);
+char *dirent_buffer(int depth);
+void *arena_alloc(size_t size);
+char *arena_strdup(const char *str);
+void archive_record(const char *src, const char *dest, struct stat *s);
+int archive_link(struct stat *s, const char *dest);
+void copy_symlink(int srcDir, int destDir, const char *name);
+void copy_special(int destDir, const char *name, struct stat *s);
+void copy_xattrs(const char *src, const char *dest);
+void archive_finish(void);
+long long copy_fd(int srcFd, int destFd, struct stat *s, char *srcFile, char *destFile, enum engine *used);
+long long copy_sparse(int srcFd, int destFd, struct stat *s, char *srcFile, char *destFile, long long *dataBytes);
+long long copy_direct(int srcFd, int destFd, struct stat *s, char *srcFile, char *destFile);
+long long copy_delta(int srcFd, int destFd, struct stat *s, struct stat *d, char *srcFile, char *destFile, long long *dataBytes);
+int up_to_date(struct stat *s, struct stat *d);
+long long copy_pipeline(int srcFd, int destFd, struct stat *s, char *srcFile, char *destFile, int nbufs, int direct);
+void *pipeline_reader(void *arg);
+void *pipeline_writer(void *arg);
+void writeback_chunk(int fd, off_t offset, size_t len, off_t *prevOffset, size_t *prevLen);
+size_t pick_buffer_size(struct stat *s);
+void write_all(int fd, const char *buffer, size_t len);
+int engine_unsupported(int err);
+void print_engines(void);
+void progress_start(void);
+void progress_stop(void);
+void progress_add(long long bytes);
+void *progress_reporter(void *arg);
+double elapsed(void);
+void print_workers(void);
+void queue_push(const char *src, const char *dest);
+int queue_pop(struct copyjob *job);
+void queue_finish(void);
+void *copy_worker(void *arg);
+int uring_works(void);
+void uring_setup(int depth);
+long long uring_add(const char *src, const char *dest, struct stat *s);
+long long uring_flush(void);
 
 
 /// main ///
 int main (int argc, char **argv) {
-	// argc -- 3 for correct usage
+	// argc -- 3 for correct usage, plus any options
 	// argv[1] -- srcDirectory
 	// argv[2] -- destDirectory
 
+	// get the options
+	static struct option longOpts[] = {
+		{ "direct", no_argument, NULL, 'd' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "j:u:dp:iDa", longOpts, NULL)) != -1) {
+		switch (opt) {
+			case 'j':	// number of threads copying files
+				numWorkers = atoi(optarg);
+				if (numWorkers <= 0) {
+					printf("copyitr: Number of jobs must be larger than 0.\n");
+					exit(1);
+				}
+				break;
+			case 'u':	// number of small files copied at once through io_uring
+				uringDepth = atoi(optarg);
+				if (uringDepth <= 0) {
+					printf("copyitr: Queue depth must be larger than 0.\n");
+					exit(1);
+				}
+				break;
+			case 'd':	// bypass the page cache for big files
+				directMode = 1;
+				break;
+			case 'i':	// only copy files that changed since the last copy
+				incremental = 1;
+				break;
+			case 'D':	// ... and only the parts of them that changed
+				incremental = 1;
+				deltaMode = 1;
+				break;
+			case 'a':	// keep links, special files and metadata as they are
+				archive = 1;
+				break;
+			case 'p':	// number of buffers between the reader and writer of a big file
+				pipelineDepth = atoi(optarg);
+				if (pipelineDepth < 2) {
+					printf("copyitr: Pipeline needs at least 2 buffers.\n");
+					exit(1);
+				}
+				break;
+			default:
+				argc = 0;	// forces the usage message below
+				break;
+		}
+	}
+
 	// check user argument count
-	if (argc != 3) {
+	if (argc - optind != 2) {
 		printf("%s: Wrong number of arguments!\n", argv[0]);
-		printf("Usage: %s <sourceDirectory> <targetDirectory>\n", argv[0]);
+		printf("Usage: %s [-j <jobs>] [-u <depth>] [--direct] [-p <buffers>] [-i|-D] [-a] <sourceDirectory> <targetDirectory>\n", argv[0]);
 		exit(1);
 	}
+	argv += optind - 1;
 
-	// set up the message display
-	if (signal(SIGALRM, display_message) == SIG_ERR) {
-		printf("copyitr: Error setting signal: %s\n", strerror(errno));
-		exit(1);
-	}
-	
-	// set first alarm	
-	alarm(1);
+	// start the progress display
+	progress_start();
 
-	int totBytes = 0;
+	long long totBytes = 0;
 
 	// check if the srcDirectory is actually a directory
 	//	if it is a file, then simply copy the file
@@ -61,8 +319,17 @@ int main (int argc, char **argv) {
 	}
 	// for a file as srcDirectory argument
 	if (s.st_mode & S_IFREG) {
-		totBytes = copyit(argv[1], argv[2]);		
-		printf("copytir: Copied %d bytes from %s to %s.\n", totBytes, argv[1], argv[2]);
+		scannedBytes = s.st_size;
+		scannedFiles = 1;
+		scanDone = 1;
+		totBytes = copyit(AT_FDCWD, argv[1], AT_FDCWD, argv[2]);		
+		if (archive) {
+			archive_record(argv[1], argv[2], &s);
+			archive_finish();
+		}
+		progress_stop();
+		printf("copytir: Copied %lld bytes (%lld physical) from %s to %s.\n", totBytes, physicalBytes, argv[1], argv[2]);
+		print_engines();
 	}	
 	// for a directory as srcDirectory argument
 	else {
@@ -71,97 +338,420 @@ int main (int argc, char **argv) {
 			printf("copyitr: Unable to create %s: %s\n", argv[2], strerror(errno));
 			exit(1);
 		}
+		// the scan works relative to the two directories from here on
+		if (strlen(argv[1]) >= PATH_MAX || strlen(argv[2]) >= PATH_MAX) {
+			printf("copyitr: %s: %s\n", argv[1], strerror(ENAMETOOLONG));
+			exit(1);
+		}
+		strcpy(srcPath, argv[1]);
+		strcpy(destPath, argv[2]);
+		if (archive) archive_record(srcPath, destPath, &s);
+		int srcDir = open(argv[1], O_RDONLY | O_DIRECTORY);
+		if (srcDir < 0) {
+			printf("copyitr: Unable to open directory %s: %s\n", argv[1], strerror(errno));
+			exit(1);
+		}
+		int destDir = open(argv[2], O_PATH | O_DIRECTORY);
+		if (destDir < 0) {
+			printf("copyitr: Unable to open directory %s: %s\n", argv[2], strerror(errno));
+			exit(1);
+		}
+		// start the workers that the scan hands files to
+		pthread_t *workers = malloc(sizeof(pthread_t) * numWorkers);
+		if (workers == NULL) {
+			printf("copyitr: Malloc error: %s\n", strerror(errno));
+			exit(1);
+		}
+		int i;
+		for (i = 0; i < numWorkers; ++i) {
+			int err = pthread_create(&workers[i], NULL, copy_worker, &stats[i + 1]);
+			if (err != 0) {
+				printf("copyitr: Unable to start worker: %s\n", strerror(err));
+				exit(1);
+			}
+		}
+
+		// small files are batched through io_uring, if the kernel lets us
+		if (uringDepth > 0) uring_setup(uringDepth);
+
 		// call recursive function to travel through the srcDirectory
-		totBytes = copyit_recur(argv[1], argv[2]);
-		printf("copyitr: Copied %d total bytes from directory %s to directory %s.\n", totBytes, argv[1], argv[2]);
+		totBytes = copyit_recur(srcDir, destDir, 0);
+		scanDone = 1;
+		close(srcDir);
+		close(destDir);
+		if (ring) totBytes += uring_flush();
+
+		// let the workers drain the queue, then add up what they copied
+		queue_finish();
+		for (i = 0; i < numWorkers; ++i) {
+			pthread_join(workers[i], NULL);
+			totBytes += stats[i + 1].totalBytes;
+		}
+		free(workers);
+		if (archive) archive_finish();
+		progress_stop();
+		printf("copyitr: Copied %lld total bytes (%lld physical) from directory %s to directory %s.\n", totBytes, physicalBytes, argv[1], argv[2]);
+		print_engines();
 	}
 
+	// and how fast it all went
+	double secs = elapsed();
+	int files = 0;
+	int i;
+	for (i = 0; i <= numWorkers; ++i) files += stats[i].files;
+	printf("copyitr: Took %.2f seconds, %.1f MiB/s, %.1f files/s.\n", secs, totBytes / secs / (1024 * 1024), files / secs);
+	if (numWorkers > 0) print_workers();
+
 	return 0;
 }
 	
 
 /* Function Name: copyit_recur
- * Preconditions:	srcPath is a valid path to the directory to be copied
- *		destPath is a valid path to the directory to which the
- *		srcPath directory will be copied
- * Recursively calls itself on other directories in srcPath, calls function
- *		copyit on files in srcPath directory.	
+ * Preconditions:	srcDir is open on the directory to be copied, whose path is in
+ *		srcPath, destDir on the directory to copy it to, whose path is in
+ *		destPath, and depth is how far below the top of the copy they are
+ * Recursively calls itself on other directories in srcDir, calls function
+ *		copyit on files in srcDir.  Entries are read with getdents64 and
+ *		looked up relative to the directory, and their type comes from the
+ *		directory entry, so directories never need a stat.
  */
-int copyit_recur(char *srcPath, char *destPath) {
-	DIR *dir;
-	struct dirent *ent;
-	if ((dir = opendir(srcPath)) == NULL) {
-		printf("copyitr: Unable to open directory %s: %s\n", srcPath, strerror(errno));
+long long copyit_recur(int srcDir, int destDir, int depth) {
+	char *buffer = dirent_buffer(depth);
+	long long totalBytes = 0;
+
+	// for each batch of items in this directory
+	long nread;
+	while ((nread = syscall(SYS_getdents64, srcDir, buffer, DIRENT_BUFFER)) != 0) {
+		if (nread < 0) {
+			printf("copyitr: Unable to read directory %s: %s\n", srcPath, strerror(errno));
+			exit(1);
+		}
+
+		// for each item in the batch
+		long offset;
+		for (offset = 0; offset < nread; offset += ((struct linux_dirent64 *)(buffer + offset))->d_reclen) {
+			struct linux_dirent64 *ent = (struct linux_dirent64 *)(buffer + offset);
+			char *name = ent->d_name;
+
+			if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+			// create new srcPath and destPath
+			size_t srcLen = path_push(srcPath, name);
+			size_t destLen = path_push(destPath, name);
+
+			// get what kind of item it is (directory or file), which for a file
+			//	means a stat anyway, for its size, and for anything in archive mode
+			//	for its metadata
+			struct stat s;
+			int isDir = ent->d_type == DT_DIR && !archive;
+			if (!isDir) {
+				if (fstatat(srcDir, name, &s, archive ? AT_SYMLINK_NOFOLLOW : 0) != 0) {
+					printf("copyitr: %s: %s\n", srcPath, strerror(errno));
+					exit(1);
+				}
+				isDir = S_ISDIR(s.st_mode);
+			}
+
+			// if it is a directory
+			if (isDir) {
+				// create destination folder to which this folder's contents will be copied
+				if (mkdirat(destDir, name, S_IRWXU) < 0 && !(incremental && errno == EEXIST)) {
+					printf("copyitr: Unable to create directory %s: %s\n", destPath, strerror(errno));
+					exit(1);
+				}
+				if (archive) archive_record(srcPath, destPath, &s);
+				int srcSub = openat(srcDir, name, O_RDONLY | O_DIRECTORY);
+				if (srcSub < 0) {
+					printf("copyitr: Unable to open directory %s: %s\n", srcPath, strerror(errno));
+					exit(1);
+				}
+				int destSub = openat(destDir, name, O_PATH | O_DIRECTORY);
+				if (destSub < 0) {
+					printf("copyitr: Unable to open directory %s: %s\n", destPath, strerror(errno));
+					exit(1);
+				}
+				// make recursive call
+				totalBytes += copyit_recur(srcSub, destSub, depth + 1);
+				close(srcSub);
+				close(destSub);
+			}
+			// if it is a file
+			// a later name of a file that's already copied is linked to the copy at the end
+			else if (S_ISREG(s.st_mode) && archive && s.st_nlink > 1 && archive_link(&s, destPath)) ;
+			else if (S_ISREG(s.st_mode)) {
+				if (archive) archive_record(srcPath, destPath, &s);
+				scannedBytes += s.st_size;
+				++scannedFiles;
+				// small files are copied in the next io_uring batch
+				//	(an existing copy has to be checked first, so that goes the usual way)
+				if (ring && s.st_size <= URING_MAX_FILE && !(incremental && faccessat(destDir, name, F_OK, 0) == 0)) {
+					totalBytes += uring_add(srcPath, destPath, &s);
+				}
+				// with workers, they copy it
+				else if (numWorkers > 0) {
+					queue_push(srcPath, destPath);
+				}
+				else {
+					totalBytes += copyit(srcDir, srcPath, destDir, destPath);
+				}
+			}
+			else if (archive) {
+				if (S_ISLNK(s.st_mode)) copy_symlink(srcDir, destDir, name);
+				else copy_special(destDir, name, &s);
+				archive_record(srcPath, destPath, &s);
+			}
+			else {
+				printf("copyitr: Unknown kind of file not handled: %s\n", srcPath);
+			}
+
+			// back to this directory's paths
+			srcPath[srcLen] = '\0';
+			destPath[destLen] = '\0';
+		}
+	}
+
+	return totalBytes;
+}
+
+
+/* Function Name: path_push
+ * Preconditions: path is one of the scan's PATH_MAX buffers
+ * Appends "/name" to path.  Returns the length path had before, to cut it back to.	*/
+size_t path_push(char *path, const char *name) {
+	size_t len = strlen(path);
+	if (len + 1 + strlen(name) >= PATH_MAX) {
+		printf("copyitr: %s/%s: %s\n", path, name, strerror(ENAMETOOLONG));
 		exit(1);
 	}
+	path[len] = '/';
+	strcpy(path + len + 1, name);
+	return len;
+}
 
-	int totalBytes = 0;
 
-	// for each item in this directory
-	while ((ent = readdir(dir)) != NULL) {
-		char dirItem[100];
-		strcpy(dirItem, ent->d_name);
+/* Function Name: dirent_buffer
+ * Returns the getdents64 buffer for directories depth levels down, allocating
+ *		it the first time the scan gets that deep.  Every directory at a level
+ *		shares the buffer, since only one of them is read at a time.	*/
+char *dirent_buffer(int depth) {
+	if (depth == direntLevels) {
+		direntBuffers = realloc(direntBuffers, sizeof(char *) * (direntLevels + 1));
+		if (direntBuffers == NULL || (direntBuffers[depth] = malloc(DIRENT_BUFFER)) == NULL) {
+			printf("copyitr: Malloc error: %s\n", strerror(errno));
+			exit(1);
+		}
+		++direntLevels;
+	}
+	return direntBuffers[depth];
+}
 
-		if (strcmp(dirItem, ".") == 0 || strcmp(dirItem, "..") == 0) continue;
 
-		// create new srcPath
-		char *newSrc = malloc(sizeof(char) * (strlen(srcPath) + 1 + strlen(dirItem) + 1));
-		if (newSrc == NULL) {
+/* Function Name: arena_alloc
+ * Returns size bytes from the arena, which are only freed when archive_finish
+ *		frees the whole arena.  Only the scan uses it.	*/
+void *arena_alloc(size_t size) {
+	size = (size + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+	if (arena == NULL || arena->used + size > ARENA_CHUNK) {
+		struct arenachunk *chunk = malloc(sizeof(struct arenachunk) + (size > ARENA_CHUNK ? size : ARENA_CHUNK));
+		if (chunk == NULL) {
 			printf("copyitr: Malloc error: %s\n", strerror(errno));
 			exit(1);
 		}
-		strcpy(newSrc, srcPath);
-		strcat(newSrc, "/");
-		strcat(newSrc, dirItem);
-		strcat(newSrc, "\0"); 
+		chunk->next = arena;
+		chunk->used = 0;
+		arena = chunk;
+	}
+	void *p = arena->data + arena->used;
+	arena->used += size;
+	return p;
+}
+
+
+/* Function Name: arena_strdup
+ * Returns a copy of str in the arena.	*/
+char *arena_strdup(const char *str) {
+	return strcpy(arena_alloc(strlen(str) + 1), str);
+}
+
+
+/* Function Name: archive_record
+ * Remembers the metadata s of src, to apply to its copy dest in archive_finish.	*/
+void archive_record(const char *src, const char *dest, struct stat *s) {
+	if (metaCount == metaSize) {
+		metaSize = metaSize ? metaSize * 2 : 1024;
+		metadata = realloc(metadata, sizeof(struct metaentry) * metaSize);
+		if (metadata == NULL) {
+			printf("copyitr: Malloc error: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+	struct metaentry *m = &metadata[metaCount++];
+	m->src = arena_strdup(src);
+	m->dest = arena_strdup(dest);
+	m->s = *s;
+}
 
-		// create new destPath
-		char *newDest = malloc(sizeof(char) * (strlen(destPath) + 1 + strlen(dirItem) + 1));
-		if (newDest == NULL) {
+
+/* Function Name: archive_link
+ * Preconditions: s is the stat of a file with more than one link, to be copied to dest
+ * Looks up the file's inode.  The first time, remembers dest as its copy and
+ *		returns 0, so the file gets copied.  After that, queues a link from
+ *		dest to the first copy and returns 1.	*/
+int archive_link(struct stat *s, const char *dest) {
+	struct linkentry **bucket = &linkBuckets[(s->st_ino ^ s->st_dev) % LINK_BUCKETS];
+	struct linkentry *l;
+	for (l = *bucket; l != NULL; l = l->next) {
+		if (l->ino == s->st_ino && l->dev == s->st_dev) break;
+	}
+
+	if (l == NULL) {
+		l = arena_alloc(sizeof(struct linkentry));
+		l->dev = s->st_dev;
+		l->ino = s->st_ino;
+		l->dest = arena_strdup(dest);
+		l->next = *bucket;
+		*bucket = l;
+		return 0;
+	}
+
+	if (linkCount == linkSize) {
+		linkSize = linkSize ? linkSize * 2 : 256;
+		hardlinks = realloc(hardlinks, sizeof(struct hardlink) * linkSize);
+		if (hardlinks == NULL) {
 			printf("copyitr: Malloc error: %s\n", strerror(errno));
 			exit(1);
 		}
-		strcpy(newDest, destPath);
-		strcat(newDest, "/");
-		strcat(newDest, dirItem);
-		strcat(newDest, "\0");
+	}
+	hardlinks[linkCount].target = l->dest;
+	hardlinks[linkCount].dest = arena_strdup(dest);
+	++linkCount;
+	return 1;
+}
+
+
+/* Function Name: copy_symlink
+ * Creates the symlink name in destDir pointing wherever name in srcDir points.	*/
+void copy_symlink(int srcDir, int destDir, const char *name) {
+	char target[PATH_MAX];
+	ssize_t len = readlinkat(srcDir, name, target, sizeof(target) - 1);
+	if (len < 0) {
+		printf("copyitr: Unable to read link %s: %s\n", srcPath, strerror(errno));
+		exit(1);
+	}
+	target[len] = '\0';
+
+	// an incremental copy replaces whatever was there
+	if (incremental) unlinkat(destDir, name, 0);
+	if (symlinkat(target, destDir, name) != 0) {
+		printf("copyitr: Unable to create link %s: %s\n", destPath, strerror(errno));
+		exit(1);
+	}
+	__sync_fetch_and_add(&myStats->files, 1);
+}
+
+
+/* Function Name: copy_special
+ * Creates a fifo, socket or device like the one with stat s as name in destDir.	*/
+void copy_special(int destDir, const char *name, struct stat *s) {
+	if (incremental) unlinkat(destDir, name, 0);
+	if (mknodat(destDir, name, s->st_mode, s->st_rdev) != 0) {
+		printf("copyitr: Unable to create %s: %s\n", destPath, strerror(errno));
+		exit(1);
+	}
+	__sync_fetch_and_add(&myStats->files, 1);
+}
 
-		// get what kind of item it is (directory or file)
-		struct stat s;
-		if (stat(newSrc, &s) != 0) {
-			printf("copyitr: %s: %s\n", newSrc, strerror(errno));
+
+/* Function Name: copy_xattrs
+ * Copies the extended attributes of src to dest, without following symlinks.
+ *		Attributes this filesystem or user can't set are left out.	*/
+void copy_xattrs(const char *src, const char *dest) {
+	static char *names = NULL, *value = NULL;
+	static size_t namesSize = 0, valueSize = 0;
+
+	// ask for the size first, so the buffers only grow when they have to
+	ssize_t len = llistxattr(src, NULL, 0);
+	if (len <= 0) return;	// none, or no xattrs on this filesystem
+	if (len > namesSize) {
+		namesSize = len;
+		if ((names = realloc(names, namesSize)) == NULL) {
+			printf("copyitr: Malloc error: %s\n", strerror(errno));
 			exit(1);
 		}
+	}
+	if ((len = llistxattr(src, names, namesSize)) <= 0) return;
 
-		// if it is a directory
-		if (s.st_mode & S_IFDIR) {
-			//printf("Found a directory: %s\n", srcPath);
-			// create destination folder to which this folder's contents will be copied
-			if (mkdir(newDest, S_IRWXU) < 0) {
-				printf("copyitr: Unable to create directory %s: %s\n", newDest, strerror(errno));
+	char *name;
+	for (name = names; name < names + len; name += strlen(name) + 1) {
+		ssize_t valueLen = lgetxattr(src, name, NULL, 0);
+		if (valueLen < 0) continue;
+		if (valueLen > valueSize) {
+			valueSize = valueLen;
+			if ((value = realloc(value, valueSize)) == NULL) {
+				printf("copyitr: Malloc error: %s\n", strerror(errno));
 				exit(1);
 			}
-			// make recursive call
-			totalBytes += copyit_recur(newSrc, newDest);
+		}
+		if ((valueLen = lgetxattr(src, name, value, valueSize)) < 0) continue;
+		if (lsetxattr(dest, name, value, valueLen, 0) != 0 && errno != ENOTSUP && errno != EPERM) {
+			printf("copyitr: Unable to copy attribute %s to %s: %s\n", name, dest, strerror(errno));
+			exit(1);
+		}
+	}
+}
 
+
+/* Function Name: archive_finish
+ * Preconditions: all the data has been copied
+ * Creates the queued hard links, then applies the recorded metadata in
+ *		reverse order: xattrs, then owner (which can clear setuid bits), then
+ *		mode, then timestamps, so nothing done after them changes them again.
+ *		Owners that can't be given away (not running as root) are left alone.	*/
+void archive_finish(void) {
+	int i;
+	for (i = 0; i < linkCount; ++i) {
+		if (incremental) unlink(hardlinks[i].dest);
+		if (link(hardlinks[i].target, hardlinks[i].dest) != 0) {
+			printf("copyitr: Unable to link %s to %s: %s\n", hardlinks[i].dest, hardlinks[i].target, strerror(errno));
+			exit(1);
 		}
-		// if it is a file
-		else if (s.st_mode & S_IFREG) {
-			//printf("Found a file.\n");
-			totalBytes += copyit(newSrc, newDest);		
+	}
+
+	for (i = metaCount - 1; i >= 0; --i) {
+		struct metaentry *m = &metadata[i];
+		copy_xattrs(m->src, m->dest);
+		if (fchownat(AT_FDCWD, m->dest, m->s.st_uid, m->s.st_gid, AT_SYMLINK_NOFOLLOW) != 0 && errno != EPERM) {
+			printf("copyitr: Unable to set owner of %s: %s\n", m->dest, strerror(errno));
+			exit(1);
 		}
-		else {
-			printf("copyitr: Unknown kind of file not handled: %s\n", srcPath);
+		// a symlink's own mode is never used
+		if (!S_ISLNK(m->s.st_mode) && fchmodat(AT_FDCWD, m->dest, m->s.st_mode & 07777, 0) != 0) {
+			printf("copyitr: Unable to set mode of %s: %s\n", m->dest, strerror(errno));
+			exit(1);
+		}
+		struct timespec times[2] = { m->s.st_atim, m->s.st_mtim };
+		if (utimensat(AT_FDCWD, m->dest, times, AT_SYMLINK_NOFOLLOW) != 0) {
+			printf("copyitr: Unable to set times of %s: %s\n", m->dest, strerror(errno));
+			exit(1);
 		}
+	}
 
-		// free the allocated memory
-		free(newSrc);
-		free(newDest);
+	while (arena != NULL) {
+		struct arenachunk *next = arena->next;
+		free(arena);
+		arena = next;
 	}
+	free(metadata);
+	free(hardlinks);
+}
 
-	free(dir);	
-	
-	return totalBytes;
+
+/* Function Name: at_name
+ * Returns the name to open path by relative to dir: the last part of the path
+ *		if dir is the directory it is in, or the whole path for AT_FDCWD.	*/
+const char *at_name(int dir, const char *path) {
+	if (dir == AT_FDCWD) return path;
+	return strrchr(path, '/') + 1;
 }
 
 
@@ -169,100 +759,976 @@ int copyit_recur(char *srcPath, char *destPath) {
  * Preconditions: srcFile is a valid path to the file to be copied
  *		destFile is a valid path for the location to which the srcFile 
  *		file will be copied, a file in path destFile does not yet exist
+ *		(unless the copy is incremental).  srcDir and destDir are either
+ *		AT_FDCWD or open on the directories the files are in, which the files
+ *		are then opened relative to.
  * Creates a copy of file at path srcFile at destFile location.		*/ 
-int copyit(char *srcFile, char *destFile) {
+long long copyit(int srcDir, char *srcFile, int destDir, char *destFile) {
 	// open the sourceFile, check for error
-	FILE *srcF = fopen(srcFile, "r");
-	if (srcF == NULL) {
+	int srcFd = openat(srcDir, at_name(srcDir, srcFile), O_RDONLY);
+	if (srcFd < 0) {
 		printf("copyitr: Unable to open %s: %s\n", srcFile, strerror(errno));
 		exit(1);
 	}
+
+	// the size and block size decide how the file gets copied
+	struct stat s;
+	if (fstat(srcFd, &s) != 0) {
+		printf("copyitr: %s: %s\n", srcFile, strerror(errno));
+		exit(1);
+	}
 	
 	// check to see if the destinationFile already exists, if yes, give error message
-	if (access(destFile, F_OK) != -1) {
+	//	unless this is an incremental copy, which updates it (or skips it if it's current)
+	struct stat d;
+	int destExists = fstatat(destDir, at_name(destDir, destFile), &d, 0) == 0;
+	if (destExists && !incremental) {
 		printf("copyitr: File %s already exists. Please rename the original file before copying.\n", destFile);
 		exit(1);
 	}
+	if (destExists && up_to_date(&s, &d)) {
+		__sync_fetch_and_add(&skippedFiles, 1);
+		__sync_fetch_and_add(&myStats->files, 1);
+		progress_add(s.st_size);	// it's as good as copied
+		close(srcFd);
+		return 0;
+	}
+
+	// an existing copy can be patched where it differs, anything else is rewritten
+	int patch = destExists && deltaMode && S_ISREG(d.st_mode) && d.st_size > 0 && s.st_size > 0;
  
 	// open the destinationFile, check for error
-	FILE *destF = fopen(destFile, "w");
-	if (destF == NULL) {
+	int destFd = patch ? openat(destDir, at_name(destDir, destFile), O_RDWR) :
+		openat(destDir, at_name(destDir, destFile), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (destFd < 0) {
 		printf("copyitr: Unable to open %s: %s\n", destFile, strerror(errno));
 		exit(1);
 	} 
+
+	// tell the kernel to read ahead aggressively, since the whole file is read once in order
+	posix_fadvise(srcFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	enum engine used;	// set by whichever engine ends up copying the file
+	long long totalBytes = -1;
+	long long dataBytes = -1;
+	if (patch) {
+		used = ENGINE_DELTA;
+		totalBytes = copy_delta(srcFd, destFd, &s, &d, srcFile, destFile, &dataBytes);
+	}
+	// a file with fewer blocks than its size has holes, so only copy the parts with data
+	else if ((off_t)s.st_blocks * 512 < s.st_size) {
+		used = ENGINE_SPARSE;
+		totalBytes = copy_sparse(srcFd, destFd, &s, srcFile, destFile, &dataBytes);
+	}
+	if (totalBytes < 0 && directMode && s.st_size >= DIRECT_MIN) {
+		used = ENGINE_DIRECT;
+		totalBytes = copy_direct(srcFd, destFd, &s, srcFile, destFile);
+	}
+	// between two devices the kernel can't do much better than we can, so keep both busy
+	if (totalBytes < 0 && pipelineDepth > 0 && s.st_size >= PIPELINE_MIN) {
+		struct stat destStat;
+		if (fstat(destFd, &destStat) == 0 && destStat.st_dev != s.st_dev) {
+			used = ENGINE_PIPELINE;
+			totalBytes = copy_pipeline(srcFd, destFd, &s, srcFile, destFile, pipelineDepth, 0);
+		}
+	}
+	// without O_DIRECT (or where the filesystem won't do it), use the cheapest engine
+	if (totalBytes < 0) totalBytes = copy_fd(srcFd, destFd, &s, srcFile, destFile, &used);
+	__sync_fetch_and_add(&engineFiles[used], 1);
+	__sync_fetch_and_add(&physicalBytes, dataBytes >= 0 ? dataBytes : totalBytes);
+	__sync_fetch_and_add(&myStats->files, 1);
+
+	// the copy is done with the source, so don't let it crowd other data out of the page cache
+	posix_fadvise(srcFd, 0, 0, POSIX_FADV_DONTNEED);
+
+	// an incremental copy recognizes an unchanged file by its size and time, so every
+	//	copy gets the source's times, or the first -i after a plain copy would redo them all
+	struct timespec times[2] = { s.st_atim, s.st_mtim };
+	futimens(destFd, times);
 	 
-	int stillReading = 1;
-	int totalBytes = 0;
-	
-	// set the alarm for the first display
-	alarm(1);
- 
+	 // close sourceFile, check for error closing
+	if (close(srcFd) < 0){
+		printf("copyitr: Error closing %s: %s\n", srcFile, strerror(errno));
+		exit(1);
+	}
+	 
+	// close destinationFile, check for error closing
+	if (close(destFd) < 0) {
+		printf("copyitr: Error closing %s: %s\n", destFile, strerror(errno));
+		exit(1);
+	}
+
+	return totalBytes;
+}
+
+
+/* Function Name: copy_fd
+ * Preconditions: srcFd is open for reading at offset 0, destFd is an empty
+ *		file open for writing, s is the source file's stat
+ * Copies the data with the cheapest engine that works for this pair of files:
+ *		a reflink clone, then copy_file_range, then sendfile, and finally a
+ *		read/write loop through a user buffer.  Each engine picks up at the
+ *		file offsets the previous one stopped at.  The engine that finished
+ *		the copy is stored in *used.  Returns the number of bytes copied.	*/
+long long copy_fd(int srcFd, int destFd, struct stat *s, char *srcFile, char *destFile, enum engine *used) {
+	long long totalBytes = 0;
 
-	char *buffer = malloc(sizeof(char) * BUFFERSIZE);
+	// a clone shares the source's blocks, so nothing has to be copied at all
+	*used = ENGINE_CLONE;
+	if (ioctl(destFd, FICLONE, srcFd) == 0) {
+		progress_add(s->st_size);
+		return s->st_size;
+	}
+
+	// copy_file_range keeps the data in the kernel, and lets the filesystem
+	//	do a server-side or reflink copy when it can
+	*used = ENGINE_COPY_RANGE;
+	while (1) {
+		ssize_t justCopied = copy_file_range(srcFd, NULL, destFd, NULL, MAX_CHUNK, 0);
+		if (justCopied == 0) return totalBytes;
+		if (justCopied > 0) {
+			totalBytes += justCopied;
+			progress_add(justCopied);
+		}
+		else if (errno == EINTR) continue;
+		else if (engine_unsupported(errno)) break;
+		else {
+			printf("copyitr: Error copying %s to %s: %s\n", srcFile, destFile, strerror(errno));
+			exit(1);
+		}
+	}
+
+	// sendfile still avoids the copy through user space
+	*used = ENGINE_SENDFILE;
+	while (1) {
+		ssize_t justCopied = sendfile(destFd, srcFd, NULL, MAX_CHUNK);
+		if (justCopied == 0) return totalBytes;
+		if (justCopied > 0) {
+			totalBytes += justCopied;
+			progress_add(justCopied);
+		}
+		else if (errno == EINTR) continue;
+		else if (engine_unsupported(errno)) break;
+		else {
+			printf("copyitr: Error copying %s to %s: %s\n", srcFile, destFile, strerror(errno));
+			exit(1);
+		}
+	}
+
+	// last resort, read and write through a buffer sized for the file
+	*used = ENGINE_READWRITE;
+	size_t bufferSize = pick_buffer_size(s);
+	char *buffer = malloc(sizeof(char) * bufferSize);
 	if (buffer == NULL) {
 		printf("copyitr: Malloc error: %s\n", strerror(errno));
 		exit(1);
 	}
-	//enter loop for reading and copying file
-	while (stillReading) {
-		int justRead = 0;
-		int tryAgain;
-		
-		// read from max of BUFFERSIZE bytes from sourceFile
-		do {
-			justRead = fread(buffer, sizeof(char), BUFFERSIZE, srcF);
-			if (justRead >= 0) tryAgain = 0;	// successful read
-			else if (errno == EINTR) tryAgain = 1;	//read failed because of an interrupt
-			else {		//read failed for a fatal reason and prog should exit with error message
+	off_t prevOffset = 0;
+	size_t prevLen = 0;
+	while (1) {
+		ssize_t justRead = read(srcFd, buffer, bufferSize);
+		if (justRead == 0) break;
+		if (justRead < 0) {
+			if (errno == EINTR) continue;	//read failed because of an interrupt
+			printf("copyitr: Error reading: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		write_all(destFd, buffer, justRead);
+		writeback_chunk(destFd, totalBytes, justRead, &prevOffset, &prevLen);
+		posix_fadvise(srcFd, totalBytes, justRead, POSIX_FADV_DONTNEED);
+
+		totalBytes += justRead;
+		progress_add(justRead);
+	}
+	free(buffer);
+
+	return totalBytes;
+}
+
+
+/* Function Name: copy_sparse
+ * Preconditions: as for copy_fd
+ * Copies only the data extents of a file with holes, found with SEEK_DATA and
+ *		SEEK_HOLE, to the same offsets in the destination, and punches out the
+ *		holes in between so they stay holes even if the destination had data.
+ *		The number of bytes of data copied is stored in *dataBytes.  Returns
+ *		the size of the file, or -1 without copying anything if the filesystem
+ *		can't report holes.	*/
+long long copy_sparse(int srcFd, int destFd, struct stat *s, char *srcFile, char *destFile, long long *dataBytes) {
+	*dataBytes = 0;
+	if (lseek(srcFd, 0, SEEK_DATA) < 0 && errno != ENXIO) return -1;
+
+	// the destination gets its full size up front, so everything not written is a hole
+	if (ftruncate(destFd, s->st_size) != 0) {
+		printf("copyitr: Error writing %s: %s\n", destFile, strerror(errno));
+		exit(1);
+	}
+
+	char *buffer = NULL;	// only allocated if copy_file_range can't be used
+	size_t bufferSize = pick_buffer_size(s);
+	off_t holeStart = 0;
+	off_t dataStart;
+	while (holeStart < s->st_size && (dataStart = lseek(srcFd, holeStart, SEEK_DATA)) >= 0) {
+		off_t dataEnd = lseek(srcFd, dataStart, SEEK_HOLE);
+		if (dataEnd < 0) {
+			printf("copyitr: Error reading %s: %s\n", srcFile, strerror(errno));
+			exit(1);
+		}
+
+		if (dataStart > holeStart) fallocate(destFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, holeStart, dataStart - holeStart);
+
+		// copy the extent in the kernel if possible, otherwise through a buffer
+		off_t inOffset = dataStart, outOffset = dataStart;
+		while (inOffset < dataEnd) {
+			size_t want = dataEnd - inOffset < MAX_CHUNK ? dataEnd - inOffset : MAX_CHUNK;
+			if (buffer == NULL) {
+				ssize_t justCopied = copy_file_range(srcFd, &inOffset, destFd, &outOffset, want, 0);
+				if (justCopied == 0) break;	// the file shrank
+				if (justCopied > 0) progress_add(justCopied);
+				if (justCopied > 0 || errno == EINTR) continue;
+				if (!engine_unsupported(errno)) {
+					printf("copyitr: Error copying %s to %s: %s\n", srcFile, destFile, strerror(errno));
+					exit(1);
+				}
+				if ((buffer = malloc(bufferSize)) == NULL) {
+					printf("copyitr: Malloc error: %s\n", strerror(errno));
+					exit(1);
+				}
+			}
+
+			ssize_t justRead = pread(srcFd, buffer, want < bufferSize ? want : bufferSize, inOffset);
+			if (justRead == 0) break;	// the file shrank
+			if (justRead < 0) {
+				if (errno == EINTR) continue;
 				printf("copyitr: Error reading: %s\n", strerror(errno));
 				exit(1);
 			}
-		} while (tryAgain);
-
-		if (justRead == 0) stillReading = 0;
-		else {
-			// write to destinationFile
-			do {
-				//if (write(destFd, buffer, justRead) >= 0) tryAgain = 0;	//successful write
-				if (fwrite(buffer, justRead, sizeof(char), destF) >= 0) tryAgain = 0;
-				else if (errno == EINTR) {
-					printf("Had to try again\n");
-					tryAgain = 1;	//write failed because of an interrupt
-				}
-				else {	//write failed for a fatal reason and prog should exit with error message
+			ssize_t written = 0;
+			while (written < justRead) {
+				ssize_t justWrote = pwrite(destFd, buffer + written, justRead - written, outOffset + written);
+				if (justWrote >= 0) written += justWrote;
+				else if (errno != EINTR) {
 					printf("copyitr: Error writing: %s\n", strerror(errno));
 					exit(1);
 				}
-			} while (tryAgain);
-
-			totalBytes += justRead;
+			}
+			inOffset += justRead;
+			outOffset += justRead;
+			progress_add(justRead);
 		}
+
+		*dataBytes += inOffset - dataStart;
+		holeStart = dataEnd;
 	}
 	free(buffer);
-	 
-	 // close sourceFile, check for error closing
-	if (fclose(srcF) < 0){
-		printf("copyitr: Error closing %s: %s\n", srcFile, strerror(errno));
+
+	// whatever is left after the last extent is a hole too
+	if (holeStart < s->st_size) fallocate(destFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, holeStart, s->st_size - holeStart);
+	progress_add(s->st_size - *dataBytes);	// the holes are done too
+
+	return s->st_size;
+}
+
+
+/* Function Name: up_to_date
+ * Returns true if the copy with stat d looks the same as the source with stat
+ *		s: a regular file of the same size and modification time.	*/
+int up_to_date(struct stat *s, struct stat *d) {
+	return S_ISREG(d->st_mode) && d->st_size == s->st_size &&
+		d->st_mtim.tv_sec == s->st_mtim.tv_sec && d->st_mtim.tv_nsec == s->st_mtim.tv_nsec;
+}
+
+
+/* Function Name: copy_delta
+ * Preconditions: srcFd is open for reading, destFd is an existing non-empty
+ *		copy open for reading and writing, s and d are their stats, and both
+ *		files are non-empty
+ * Brings the copy up to date in place: both files are mapped, each block of the
+ *		source is compared with the block at the same offset in the copy, and
+ *		only blocks that differ (or lie past the end of the copy) are written.
+ *		The copy is then truncated to the source's size.  The number of bytes
+ *		written is stored in *dataBytes.  Returns the size of the file.	*/
+long long copy_delta(int srcFd, int destFd, struct stat *s, struct stat *d, char *srcFile, char *destFile, long long *dataBytes) {
+	char *src = mmap(0, s->st_size, PROT_READ, MAP_SHARED, srcFd, 0);
+	if (src == MAP_FAILED) {
+		printf("copyitr: Unable to map %s: %s\n", srcFile, strerror(errno));
 		exit(1);
 	}
-	 
-	// close destinationFile, check for error closing
-	if (fclose(destF) < 0) {
-		printf("copyitr: Error closing %s: %s\n", destFile, strerror(errno));
+	char *dest = mmap(0, d->st_size, PROT_READ, MAP_SHARED, destFd, 0);
+	if (dest == MAP_FAILED) {
+		printf("copyitr: Unable to map %s: %s\n", destFile, strerror(errno));
+		exit(1);
+	}
+	madvise(src, s->st_size, MADV_SEQUENTIAL);
+	madvise(dest, d->st_size, MADV_SEQUENTIAL);
+
+	*dataBytes = 0;
+	off_t offset;
+	for (offset = 0; offset < s->st_size; offset += DELTA_BLOCK) {
+		size_t len = s->st_size - offset < DELTA_BLOCK ? s->st_size - offset : DELTA_BLOCK;
+
+		// the part of the block the copy already has, if it matches, is kept
+		if (offset + len <= d->st_size && memcmp(src + offset, dest + offset, len) == 0) {
+			__sync_fetch_and_add(&reusedBytes, len);
+			progress_add(len);
+			continue;
+		}
+
+		size_t written = 0;
+		while (written < len) {
+			ssize_t justWrote = pwrite(destFd, src + offset + written, len - written, offset + written);
+			if (justWrote >= 0) written += justWrote;
+			else if (errno != EINTR) {
+				printf("copyitr: Error writing: %s\n", strerror(errno));
+				exit(1);
+			}
+		}
+		*dataBytes += len;
+		progress_add(len);
+	}
+
+	munmap(src, s->st_size);
+	munmap(dest, d->st_size);
+
+	// drop whatever the copy had past the new end of the file
+	if (ftruncate(destFd, s->st_size) != 0) {
+		printf("copyitr: Error writing %s: %s\n", destFile, strerror(errno));
+		exit(1);
+	}
+
+	return s->st_size;
+}
+
+
+/* Function Name: copy_direct
+ * Preconditions: as for copy_fd
+ * Copies the file with O_DIRECT on both ends, so neither file goes through the
+ *		page cache.  Returns the number of bytes copied, or -1 without copying
+ *		anything if the filesystem doesn't support O_DIRECT.	*/
+long long copy_direct(int srcFd, int destFd, struct stat *s, char *srcFile, char *destFile) {
+	// O_DIRECT can be switched on for descriptors that are already open
+	int srcFlags = fcntl(srcFd, F_GETFL);
+	int destFlags = fcntl(destFd, F_GETFL);
+	if (fcntl(srcFd, F_SETFL, srcFlags | O_DIRECT) != 0) return -1;
+	if (fcntl(destFd, F_SETFL, destFlags | O_DIRECT) != 0) {
+		fcntl(srcFd, F_SETFL, srcFlags);
+		return -1;
+	}
+
+	// a read into one buffer overlaps the write of the other, or more with -p
+	return copy_pipeline(srcFd, destFd, s, srcFile, destFile, pipelineDepth > DIRECT_BUFFERS ? pipelineDepth : DIRECT_BUFFERS, 1);
+}
+
+
+/* Function Name: copy_pipeline
+ * Preconditions: as for copy_fd, nbufs is at least 2, direct is set if both
+ *		files have O_DIRECT on
+ * Copies the file with a reader thread filling a ring of nbufs buffers and a
+ *		writer thread emptying it, so the source and destination are busy at the
+ *		same time.  Returns the number of bytes copied.	*/
+long long copy_pipeline(int srcFd, int destFd, struct stat *s, char *srcFile, char *destFile, int nbufs, int direct) {
+	struct pipeline p;
+	p.srcFd = srcFd;
+	p.destFd = destFd;
+	p.srcFile = srcFile;
+	p.destFile = destFile;
+	p.direct = direct;
+	p.nbufs = nbufs;
+	p.filled = 0;
+	p.eof = 0;
+	p.stats = myStats;
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.changed, NULL);
+
+	// with O_DIRECT the buffer size has to be a multiple of the alignment too
+	p.bufferSize = pick_buffer_size(s);
+	if (direct) p.bufferSize = (p.bufferSize + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+
+	p.bufs = malloc(sizeof(char *) * nbufs);
+	p.lens = malloc(sizeof(ssize_t) * nbufs);
+	if (p.bufs == NULL || p.lens == NULL) {
+		printf("copyitr: Malloc error: %s\n", strerror(errno));
 		exit(1);
 	}
+	int i;
+	for (i = 0; i < nbufs; ++i) {
+		int err = posix_memalign((void **)&p.bufs[i], DIRECT_ALIGN, p.bufferSize);
+		if (err != 0) {
+			printf("copyitr: Malloc error: %s\n", strerror(err));
+			exit(1);
+		}
+	}
+
+	pthread_t reader, writer;
+	int err = pthread_create(&reader, NULL, pipeline_reader, &p);
+	if (err == 0) err = pthread_create(&writer, NULL, pipeline_writer, &p);
+	if (err != 0) {
+		printf("copyitr: Unable to start pipeline: %s\n", strerror(err));
+		exit(1);
+	}
+
+	pthread_join(reader, NULL);
+	pthread_join(writer, NULL);
+
+	for (i = 0; i < nbufs; ++i) free(p.bufs[i]);
+	free(p.bufs);
+	free(p.lens);
+	pthread_mutex_destroy(&p.lock);
+	pthread_cond_destroy(&p.changed);
+
+	return p.totalBytes;
+}
+
+
+/* Function Name: pipeline_reader
+ * Preconditions: arg is the pipeline of the copy
+ * Fills the pipeline's buffers in order until the end of the source file,
+ *		then sets the pipeline's totalBytes to the number of bytes read.	*/
+void *pipeline_reader(void *arg) {
+	struct pipeline *p = arg;
+	long long totalBytes = 0;
+	int slot = 0;
+
+	while (!p->eof) {
+		// wait for the writer to finish with this buffer
+		pthread_mutex_lock(&p->lock);
+		while (p->filled == p->nbufs) pthread_cond_wait(&p->changed, &p->lock);
+		pthread_mutex_unlock(&p->lock);
+
+		// fill the whole buffer, anything less means the end of the file
+		ssize_t len = 0;
+		while (len < p->bufferSize) {
+			ssize_t justRead = read(p->srcFd, p->bufs[slot] + len, p->bufferSize - len);
+			if (justRead == 0) break;
+			if (justRead < 0) {
+				if (errno == EINTR) continue;
+				printf("copyitr: Error reading %s: %s\n", p->srcFile, strerror(errno));
+				exit(1);
+			}
+			len += justRead;
+		}
+		if (!p->direct) posix_fadvise(p->srcFd, totalBytes, len, POSIX_FADV_DONTNEED);
+		totalBytes += len;
+
+		pthread_mutex_lock(&p->lock);
+		p->lens[slot] = len;
+		++p->filled;
+		if (len < p->bufferSize) p->eof = 1;
+		pthread_cond_signal(&p->changed);
+		pthread_mutex_unlock(&p->lock);
+
+		slot = (slot + 1) % p->nbufs;
+	}
+
+	p->totalBytes = totalBytes;
+	return NULL;
+}
+
+
+/* Function Name: pipeline_writer
+ * Preconditions: arg is the pipeline of the copy
+ * Writes out the buffers the reader fills, in order, until the last one.	*/
+void *pipeline_writer(void *arg) {
+	struct pipeline *p = arg;
+	int slot = 0;
+	off_t offset = 0;
+	off_t prevOffset = 0;
+	size_t prevLen = 0;
+	myStats = p->stats;
+
+	while (1) {
+		pthread_mutex_lock(&p->lock);
+		while (p->filled == 0) pthread_cond_wait(&p->changed, &p->lock);
+		int last = p->eof && p->filled == 1;
+		pthread_mutex_unlock(&p->lock);
+
+		// the tail of the file isn't a whole block, so it has to go through the page cache
+		ssize_t len = p->lens[slot];
+		if (p->direct && len % DIRECT_ALIGN != 0) fcntl(p->destFd, F_SETFL, fcntl(p->destFd, F_GETFL) & ~O_DIRECT);
+		write_all(p->destFd, p->bufs[slot], len);
+		if (!p->direct) writeback_chunk(p->destFd, offset, len, &prevOffset, &prevLen);
+		offset += len;
+		progress_add(len);
+
+		pthread_mutex_lock(&p->lock);
+		--p->filled;
+		pthread_cond_signal(&p->changed);
+		pthread_mutex_unlock(&p->lock);
+
+		if (last) break;
+		slot = (slot + 1) % p->nbufs;
+	}
+
+	return NULL;
+}
+
+
+/* Function Name: writeback_chunk
+ * Preconditions: len bytes at offset were just written to fd, *prevOffset and
+ *		*prevLen describe the chunk written before it (length 0 if none)
+ * Starts writeback of this chunk, then waits for the previous one and drops it
+ *		from the page cache, so a big copy only ever keeps two chunks cached.	*/
+void writeback_chunk(int fd, off_t offset, size_t len, off_t *prevOffset, size_t *prevLen) {
+	sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE);
+	if (*prevLen > 0) {
+		sync_file_range(fd, *prevOffset, *prevLen, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(fd, *prevOffset, *prevLen, POSIX_FADV_DONTNEED);
+	}
+	*prevOffset = offset;
+	*prevLen = len;
+}
+
+
+/* Function Name: pick_buffer_size
+ * Returns the buffer size to copy the file with stat s: big enough to read a
+ *		small file in one go, a whole number of the file's blocks, and never
+ *		more than MAX_BUFFERSIZE or less than MIN_BUFFERSIZE.	*/
+size_t pick_buffer_size(struct stat *s) {
+	size_t block = s->st_blksize > 0 ? s->st_blksize : DIRECT_ALIGN;
+	size_t size = (s->st_size + block - 1) / block * block;
+
+	if (size > MAX_BUFFERSIZE) size = MAX_BUFFERSIZE / block * block;
+	if (size < MIN_BUFFERSIZE) size = MIN_BUFFERSIZE;
+	return size;
+}
+
+
+/* Function Name: write_all
+ * Writes all len bytes of buffer to fd, since a write can come up short.	*/
+void write_all(int fd, const char *buffer, size_t len) {
+	size_t written = 0;
+	while (written < len) {
+		ssize_t justWrote = write(fd, buffer + written, len - written);
+		if (justWrote >= 0) written += justWrote;
+		else if (errno != EINTR) {	//write failed for a fatal reason and prog should exit with error message
+			printf("copyitr: Error writing: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+}
+
+
+/* Function Name: engine_unsupported
+ * Returns true if err means the engine can't be used on these files (so the
+ *		next one should be tried) rather than that the copy failed.	*/
+int engine_unsupported(int err) {
+	return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP || err == EBADF;
+}
+
+
+/* Function Name: print_engines
+ * Prints how many files each copy engine was used for.	*/
+void print_engines(void) {
+	int i;
+	printf("copyitr: Engines used:");
+	for (i = 0; i < NUM_ENGINES; ++i) {
+		printf(" %s %d%s", engineNames[i], engineFiles[i], i == NUM_ENGINES - 1 ? " files.\n" : ",");
+	}
+	if (incremental) printf("copyitr: Skipped %d unchanged files, kept %lld bytes of changed files.\n", skippedFiles, reusedBytes);
+}
+
+
+/* Function Name: queue_push
+ * Preconditions: src and dest are the paths of a file to copy, shorter than PATH_MAX
+ * Adds a copy job to the queue, waiting for room if the workers are behind.
+ *		The directory the file goes in must already exist.	*/
+void queue_push(const char *src, const char *dest) {
+	pthread_mutex_lock(&queue.lock);
+	while (queue.count == QUEUE_SIZE) pthread_cond_wait(&queue.notFull, &queue.lock);
+
+	struct copyjob *job = &queue.jobs[(queue.head + queue.count) % QUEUE_SIZE];
+	strcpy(job->src, src);
+	strcpy(job->dest, dest);
+	++queue.count;
+
+	pthread_cond_signal(&queue.notEmpty);
+	pthread_mutex_unlock(&queue.lock);
+}
+
+
+/* Function Name: queue_pop
+ * Takes the next copy job off the queue into *job, waiting for one if the
+ *		queue is empty.  Returns 0 once the scan is done and the queue is empty.	*/
+int queue_pop(struct copyjob *job) {
+	pthread_mutex_lock(&queue.lock);
+	while (queue.count == 0 && !queue.done) pthread_cond_wait(&queue.notEmpty, &queue.lock);
+
+	if (queue.count == 0) {
+		pthread_mutex_unlock(&queue.lock);
+		return 0;
+	}
+
+	*job = queue.jobs[queue.head];
+	queue.head = (queue.head + 1) % QUEUE_SIZE;
+	--queue.count;
+
+	pthread_cond_signal(&queue.notFull);
+	pthread_mutex_unlock(&queue.lock);
+	return 1;
+}
+
+
+/* Function Name: queue_finish
+ * Tells the workers no more jobs are coming.	*/
+void queue_finish(void) {
+	pthread_mutex_lock(&queue.lock);
+	queue.done = 1;
+	pthread_cond_broadcast(&queue.notEmpty);
+	pthread_mutex_unlock(&queue.lock);
+}
+
 
+/* Function Name: copy_worker
+ * Preconditions: arg points to this worker's copystats, initially all 0
+ * Copies files off the queue until there are no more.	*/
+void *copy_worker(void *arg) {
+	myStats = arg;
+	struct copyjob job;
+
+	while (queue_pop(&job)) {
+		myStats->totalBytes += copyit(AT_FDCWD, job.src, AT_FDCWD, job.dest);
+	}
+
+	return NULL;
+}
+
+
+/* Function Name: uring_works
+ * Preconditions: ring is open with its fixed file table registered
+ * Checks that the kernel has every operation uring_flush uses, and that openat
+ *		can open straight into a fixed slot (file_index, 5.15 and later) by
+ *		opening and closing "." in slot 0.  Returns 1 if so, 0 if not.	*/
+int uring_works(void) {
+	const int ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_STATX, IORING_OP_CLOSE };
+	if (!uring_probe(ring, ops, 5)) return 0;
+
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long)".";
+	sqe->open_flags = O_RDONLY;
+	sqe->file_index = 1;
+	if (uring_submit_wait(ring, 1) != 0) return 0;
+
+	unsigned long long userData;
+	int res;
+	if (!uring_next_cqe(ring, &userData, &res) || res < 0) return 0;
+
+	sqe = uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = 1;
+	if (uring_submit_wait(ring, 1) != 0) return 0;
+	return uring_next_cqe(ring, &userData, &res) && res == 0;
+}
+
+
+/* Function Name: uring_setup
+ * Sets up the io_uring and the buffers for batches of depth small files.  If
+ *		io_uring isn't available, says so and leaves ring null so every file
+ *		takes the usual path.	*/
+void uring_setup(int depth) {
+	// each file needs an open, open, read, write and statx, and later two closes
+	ring = uring_open(depth * 8);
+	if (ring && (uring_register_files(ring, depth * 2) != 0 || !uring_works())) {
+		uring_close(ring);
+		ring = NULL;
+	}
+	if (ring == NULL) {
+		printf("copyitr: io_uring not available, copying files one at a time.\n");
+		return;
+	}
+
+	batch = malloc(sizeof(struct uringfile) * depth);
+	if (batch == NULL) {
+		printf("copyitr: Malloc error: %s\n", strerror(errno));
+		exit(1);
+	}
+	int i;
+	for (i = 0; i < depth; ++i) {
+		batch[i].buffer = malloc(URING_MAX_FILE);
+		if (batch[i].buffer == NULL) {
+			printf("copyitr: Malloc error: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+}
+
+
+/* Function Name: uring_add
+ * Preconditions: src and dest are the paths of a file of at most
+ *		URING_MAX_FILE bytes, shorter than PATH_MAX
+ * Adds the file to the current batch, and copies the batch once it is full.
+ *		Returns the number of bytes copied by this call (0 unless the batch ran).	*/
+long long uring_add(const char *src, const char *dest, struct stat *s) {
+	struct uringfile *f = &batch[batchCount++];
+	strcpy(f->src, src);
+	strcpy(f->dest, dest);
+	f->size = s->st_size;
+	f->times[0] = s->st_atim;
+	f->times[1] = s->st_mtim;
+
+	if (batchCount == uringDepth) return uring_flush();
+	return 0;
+}
+
+
+/* Function Name: uring_flush
+ * Copies every file in the current batch with one submission: for each file
+ *		a linked chain of openat (source), openat (destination), read, write
+ *		and a statx of the source, using fixed file slots 2i and 2i+1 so no
+ *		descriptors come back to us.  Then one more submission closes all the
+ *		slots.  A file whose size changed since the scan (a short read, or a
+ *		statx size past what was read) is copied again the usual way.
+ *		Returns the number of bytes copied.	*/
+long long uring_flush(void) {
+	long long totalBytes = 0;
+	int i;
+
+	for (i = 0; i < batchCount; ++i) {
+		struct uringfile *f = &batch[i];
+		struct io_uring_sqe *sqe;
+
+		sqe = uring_get_sqe(ring);
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long)f->src;
+		sqe->open_flags = O_RDONLY;
+		sqe->file_index = 2*i + 1;	// slot + 1, 0 would mean a normal descriptor
+		sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data = URING_OPS*i;
+
+		// O_EXCL does the "already exists" check as part of the open
+		sqe = uring_get_sqe(ring);
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long)f->dest;
+		sqe->open_flags = O_WRONLY | O_CREAT | O_EXCL;
+		sqe->len = 0666;
+		sqe->file_index = 2*i + 2;
+		sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data = URING_OPS*i + 1;
+
+		sqe = uring_get_sqe(ring);
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = 2*i;
+		sqe->addr = (unsigned long)f->buffer;
+		sqe->len = f->size;
+		sqe->off = 0;
+		sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+		sqe->user_data = URING_OPS*i + 2;
+
+		sqe = uring_get_sqe(ring);
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = 2*i + 1;
+		sqe->addr = (unsigned long)f->buffer;
+		sqe->len = f->size;
+		sqe->off = 0;
+		sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+		sqe->user_data = URING_OPS*i + 3;
+
+		// the read stops at the size from the scan, so only this shows a file that grew since
+		sqe = uring_get_sqe(ring);
+		sqe->opcode = IORING_OP_STATX;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long)f->src;
+		sqe->len = STATX_SIZE;
+		sqe->off = (unsigned long)&f->after;
+		sqe->user_data = URING_OPS*i + 4;
+	}
+
+	if (uring_submit_wait(ring, URING_OPS*batchCount) != 0) {
+		printf("copyitr: io_uring_enter: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	unsigned long long userData;
+	int res;
+	while (uring_next_cqe(ring, &userData, &res)) {
+		batch[userData / URING_OPS].res[userData % URING_OPS] = res;
+	}
+
+	// close whatever was opened, all at once
+	int closes = 0;
+	for (i = 0; i < batchCount; ++i) {
+		int j;
+		for (j = 0; j < 2; ++j) {
+			if (batch[i].res[j] < 0) continue;
+			struct io_uring_sqe *sqe = uring_get_sqe(ring);
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->file_index = 2*i + j + 1;
+			++closes;
+		}
+	}
+	if (uring_submit_wait(ring, closes) != 0) {
+		printf("copyitr: io_uring_enter: %s\n", strerror(errno));
+		exit(1);
+	}
+	while (uring_next_cqe(ring, &userData, &res)) ;
+
+	// report errors the same way the one-at-a-time copy does
+	for (i = 0; i < batchCount; ++i) {
+		struct uringfile *f = &batch[i];
+
+		if (f->res[0] < 0) {
+			printf("copyitr: Unable to open %s: %s\n", f->src, strerror(-f->res[0]));
+			exit(1);
+		}
+		if (f->res[1] == -EEXIST) {
+			printf("copyitr: File %s already exists. Please rename the original file before copying.\n", f->dest);
+			exit(1);
+		}
+		if (f->res[1] < 0) {
+			printf("copyitr: Unable to open %s: %s\n", f->dest, strerror(-f->res[1]));
+			exit(1);
+		}
+		if (f->res[2] < 0 && f->res[2] != -ECANCELED) {
+			printf("copyitr: Error reading: %s\n", strerror(-f->res[2]));
+			exit(1);
+		}
+		if (f->res[3] < 0 && f->res[3] != -ECANCELED) {
+			printf("copyitr: Error writing: %s\n", strerror(-f->res[3]));
+			exit(1);
+		}
+
+		if (f->res[2] == f->size && f->res[3] == f->size && f->res[4] == 0 && (off_t)f->after.stx_size == f->size) {
+			totalBytes += f->size;
+			progress_add(f->size);
+			__sync_fetch_and_add(&myStats->files, 1);
+			__sync_fetch_and_add(&engineFiles[ENGINE_URING], 1);
+			__sync_fetch_and_add(&physicalBytes, f->size);
+			utimensat(AT_FDCWD, f->dest, f->times, 0);
+		}
+		else {
+			// the file changed size since the scan, so start it over
+			unlink(f->dest);
+			totalBytes += copyit(AT_FDCWD, f->src, AT_FDCWD, f->dest);
+		}
+	}
+
+	batchCount = 0;
 	return totalBytes;
 }
 
 
-/* Function Name: display_message
- */
-void display_message(int s) {
-	// print message
-	printf("copyit: still copying...\n");
-	
-	// reset the alarm so it will display again in 1 second
-	alarm(1);
+/* Function Name: progress_start
+ * Starts the clock and the thread that reports progress every second, with
+ *		a copystats for the scan and one for each worker.	*/
+void progress_start(void) {
+	clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+	stats = calloc(numWorkers + 1, sizeof(struct copystats));
+	if (stats == NULL) {
+		printf("copyitr: Malloc error: %s\n", strerror(errno));
+		exit(1);
+	}
+	myStats = &stats[0];
+
+	reporterStop = eventfd(0, 0);
+	if (reporterStop < 0) {
+		printf("copyitr: Unable to start progress display: %s\n", strerror(errno));
+		exit(1);
+	}
+	int err = pthread_create(&reporter, NULL, progress_reporter, NULL);
+	if (err != 0) {
+		printf("copyitr: Unable to start progress display: %s\n", strerror(err));
+		exit(1);
+	}
+}
+
+
+/* Function Name: progress_stop
+ * Stops the progress reporter, so the summary isn't interleaved with it.	*/
+void progress_stop(void) {
+	uint64_t one = 1;
+	if (write(reporterStop, &one, sizeof(one)) != sizeof(one)) {
+		printf("copyitr: Unable to stop progress display: %s\n", strerror(errno));
+		exit(1);
+	}
+	pthread_join(reporter, NULL);
+	close(reporterStop);
+}
+
+
+/* Function Name: progress_add
+ * Counts bytes of the file being copied as done, for the progress display.	*/
+void progress_add(long long bytes) {
+	__sync_fetch_and_add(&myStats->bytes, bytes);
+}
+
+
+/* Function Name: progress_reporter
+ * Wakes up every second on a timerfd and prints how much has been copied, how
+ *		fast, and when it should be done, until progress_stop says to finish.
+ *		The rates are over the last interval, the ETA uses the rate since the
+ *		start, and it can only be worked out once the scan has found every file.	*/
+void *progress_reporter(void *arg) {
+	int timer = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (timer < 0) {
+		printf("copyitr: Unable to start progress timer: %s\n", strerror(errno));
+		return NULL;
+	}
+	struct itimerspec every = { { 1, 0 }, { 1, 0 } };
+	timerfd_settime(timer, 0, &every, NULL);
+
+	struct pollfd fds[2] = { { timer, POLLIN, 0 }, { reporterStop, POLLIN, 0 } };
+	long long prevBytes = 0;
+	int prevFiles = 0;
+	while (1) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (fds[1].revents) break;
+
+		// more than one tick means we fell behind, so the rates are over all of them
+		uint64_t ticks;
+		if (read(timer, &ticks, sizeof(ticks)) != sizeof(ticks)) continue;
+
+		long long bytes = 0;
+		int files = 0;
+		int i;
+		for (i = 0; i <= numWorkers; ++i) {
+			bytes += stats[i].bytes;
+			files += stats[i].files;
+		}
+		printf("copyitr: %.1f MiB in %d files, %.1f MiB/s, %.0f files/s", bytes / (1024.0 * 1024),
+			files, (bytes - prevBytes) / (1024.0 * 1024) / ticks, (double)(files - prevFiles) / ticks);
+		if (!scanDone) printf(", still scanning (%d files so far)\n", scannedFiles);
+		else if (bytes == 0) printf(", %d files to go\n", scannedFiles - files);
+		else {
+			double rate = bytes / elapsed();
+			printf(", %lld%%, ETA %.0f seconds\n", scannedBytes > 0 ? bytes * 100 / scannedBytes : 100,
+				(scannedBytes - bytes) / rate);
+		}
+		if (numWorkers > 0) print_workers();
+		fflush(stdout);
+
+		prevBytes = bytes;
+		prevFiles = files;
+	}
+
+	close(timer);
+	return NULL;
+}
+
+
+/* Function Name: elapsed
+ * Returns the number of seconds since the copy started.	*/
+double elapsed(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - startTime.tv_sec) + (now.tv_nsec - startTime.tv_nsec) / 1e9;
+}
+
+
+/* Function Name: print_workers
+ * Prints how much each worker has copied so far, to show how evenly the
+ *		files are spread over them.	*/
+void print_workers(void) {
+	int i;
+	printf("copyitr: Workers:");
+	for (i = 1; i <= numWorkers; ++i) {
+		printf(" %d %.1f MiB %d files%s", i, stats[i].bytes / (1024.0 * 1024), stats[i].files, i == numWorkers ? ".\n" : ",");
+	}
 }
- 
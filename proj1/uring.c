@@ -0,0 +1,231 @@
+/* Samantha Rack
+ * CSE 30341
+ * Project 1
+ * uring.c
+ * A minimal wrapper around the io_uring system calls: set up the rings, hand out
+ * submission entries, submit them, and read back completions.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+struct uring {
+	int fd;
+	// submission ring, shared with the kernel
+	void *sqRing;
+	size_t sqRingSize;
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	struct io_uring_sqe *sqes;
+	size_t sqesSize;
+	unsigned sqEntries;
+	unsigned pending;	// entries handed out but not yet submitted
+	// completion ring, shared with the kernel
+	void *cqRing;
+	size_t cqRingSize;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_cqe *cqes;
+};
+
+
+/* uring_open()
+ * Set up an io_uring with room for "entries" submissions.
+ * Returns a pointer to the new ring, or null if io_uring can't be used here
+ * 	(old kernel, disabled by the administrator, or out of memory).
+ */
+struct uring *uring_open( unsigned entries )
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+
+	struct uring *r = malloc(sizeof(*r));
+	if (!r) return 0;
+
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0) {
+		free(r);
+		return 0;
+	}
+
+	// map the two rings, which newer kernels put in one mapping
+	r->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cqRingSize > r->sqRingSize) r->sqRingSize = r->cqRingSize;
+		r->cqRingSize = r->sqRingSize;
+	}
+
+	r->sqRing = mmap(0, r->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sqRing == MAP_FAILED) {
+		close(r->fd);
+		free(r);
+		return 0;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) r->cqRing = r->sqRing;
+	else {
+		r->cqRing = mmap(0, r->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cqRing == MAP_FAILED) {
+			munmap(r->sqRing, r->sqRingSize);
+			close(r->fd);
+			free(r);
+			return 0;
+		}
+	}
+
+	r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(0, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		if (r->cqRing != r->sqRing) munmap(r->cqRing, r->cqRingSize);
+		munmap(r->sqRing, r->sqRingSize);
+		close(r->fd);
+		free(r);
+		return 0;
+	}
+
+	char *sq = r->sqRing;
+	r->sqHead = (unsigned *)(sq + p.sq_off.head);
+	r->sqTail = (unsigned *)(sq + p.sq_off.tail);
+	r->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sqArray = (unsigned *)(sq + p.sq_off.array);
+	r->sqEntries = p.sq_entries;
+	r->pending = 0;
+
+	char *cq = r->cqRing;
+	r->cqHead = (unsigned *)(cq + p.cq_off.head);
+	r->cqTail = (unsigned *)(cq + p.cq_off.tail);
+	r->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return r;
+}
+
+/* uring_register_files()
+ * Register an empty table of "nfiles" fixed files, which openat can then open
+ * 	straight into by setting file_index.  Returns 0 on success, -1 on failure.
+ */
+int uring_register_files( struct uring *r, int nfiles )
+{
+	int *fds = malloc(sizeof(int) * nfiles);
+	if (!fds) return -1;
+
+	// -1 marks a slot as empty
+	int i;
+	for (i = 0; i < nfiles; ++i) fds[i] = -1;
+
+	int ret = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES, fds, nfiles);
+	free(fds);
+
+	return ret < 0 ? -1 : 0;
+}
+
+/* uring_probe()
+ * Ask the kernel which operations this ring supports.  Returns 1 if every one
+ * 	of the "n" opcodes in "ops" is supported, 0 if not (or the kernel is too
+ * 	old to say).
+ */
+int uring_probe( struct uring *r, const int *ops, int n )
+{
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *p = calloc(1, size);
+	if (!p) return 0;
+
+	int ok = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, p, 256) == 0;
+	int i;
+	for (i = 0; ok && i < n; ++i) {
+		ok = ops[i] <= p->last_op && (p->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+	}
+	free(p);
+
+	return ok;
+}
+
+/* uring_get_sqe()
+ * Return a zeroed submission entry to fill in, or null if the ring is full and
+ * 	has to be submitted first.
+ */
+struct io_uring_sqe *uring_get_sqe( struct uring *r )
+{
+	unsigned head = __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+	unsigned tail = *r->sqTail + r->pending;
+	if (tail - head >= r->sqEntries) return 0;
+
+	unsigned index = tail & *r->sqMask;
+	struct io_uring_sqe *sqe = &r->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sqArray[index] = index;
+	++r->pending;
+
+	return sqe;
+}
+
+/* uring_submit_wait()
+ * Submit every entry handed out since the last call, and wait until at least
+ * 	"waitNr" completions are ready.  Returns 0 on success, -1 on failure.
+ */
+int uring_submit_wait( struct uring *r, unsigned waitNr )
+{
+	// publish the new tail only after the entries themselves are written
+	unsigned submit = r->pending;
+	__atomic_store_n(r->sqTail, *r->sqTail + submit, __ATOMIC_RELEASE);
+	r->pending = 0;
+
+	while (submit > 0) {
+		int ret = syscall(__NR_io_uring_enter, r->fd, submit, 0, 0, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		submit -= ret;
+	}
+
+	// a signal can cut getevents short, so count what is actually on the ring
+	while (__atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE) - *r->cqHead < waitNr) {
+		int ret = syscall(__NR_io_uring_enter, r->fd, 0, waitNr, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno != EINTR) return -1;
+	}
+
+	return 0;
+}
+
+/* uring_next_cqe()
+ * Take the next completion off the ring, storing its user data and result.
+ * Returns 1 if there was one, 0 if the completion ring is empty.
+ */
+int uring_next_cqe( struct uring *r, unsigned long long *userData, int *res )
+{
+	unsigned head = *r->cqHead;
+	if (head == __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE)) return 0;
+
+	struct io_uring_cqe *cqe = &r->cqes[head & *r->cqMask];
+	*userData = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(r->cqHead, head + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+/* uring_close()
+ * Tear down the ring.  Any registered files are closed along with it.
+ */
+void uring_close( struct uring *r )
+{
+	munmap(r->sqes, r->sqesSize);
+	if (r->cqRing != r->sqRing) munmap(r->cqRing, r->cqRingSize);
+	munmap(r->sqRing, r->sqRingSize);
+	close(r->fd);
+	free(r);
+}
@@ -0,0 +1,16 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+
+struct uring;
+
+struct uring *uring_open( unsigned entries );
+int uring_register_files( struct uring *r, int nfiles );
+int uring_probe( struct uring *r, const int *ops, int n );
+struct io_uring_sqe *uring_get_sqe( struct uring *r );
+int uring_submit_wait( struct uring *r, unsigned waitNr );
+int uring_next_cqe( struct uring *r, unsigned long long *userData, int *res );
+void uring_close( struct uring *r );
+
+#endif
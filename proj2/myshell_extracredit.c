@@ -4,6 +4,8 @@
  * myshell.c
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,368 +16,2429 @@
 #include <unistd.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <spawn.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sched.h>
 
+// input is read this many bytes at a time, a line can be any length
 #define MAX_INPUT_CHARS 4096
-#define MAX_WORDS 100
+
+// start and run take pipelines of up to this many programs, separated by "|"
+#define MAX_STAGES 32
+
+// programs are started with posix_spawn, which doesn't copy the shell's memory
+//	the way fork would, and reports a failed exec to the shell
+extern char **environ;
+// most bytes to ask splice or tee to move at once
+#define SPLICE_CHUNK (1024 * 1024)
+
+// start, run and time take options that limit what the job can use.  A job with
+//	limits is forked rather than spawned, and each child takes on affinity, nice, IO
+//	priority and CPU time itself before it execs.  Memory and CPU share limits put
+//	the job in its own cgroup v2 group under the shell's, which the child joins the
+//	same way, or if that isn't writable, memory falls back to an RLIMIT_AS.
+struct joblimits {
+	int set;		// any of these was given
+	int hasCpus;
+	cpu_set_t cpus;
+	int hasNice;
+	int nice;
+	int ioprio;		// class << 13 | level, or -1
+	unsigned long long memory;	// bytes, 0 for none
+	int cpuPercent;		// share of one CPU, 0 for none
+	long cpuSeconds;	// CPU time, 0 for none
+	char *cgroup;		// the job's group, NULL if it isn't in one
+};
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+char *cgroupBase = NULL;	// group the job groups are made in, set up the first time one is needed
+int cgroupTried = 0;
+
+// every start or run is a job, kept here until the shell exits for the summary of
+//	a script.  With -j, start waits for a job to finish once maxJobs are running.
+struct job {
+	char *command;		// the command line that started it
+	pid_t pids[MAX_STAGES];	// one per stage of the pipeline
+	int numPids;
+	int running;		// processes not reaped yet
+	int stopped;		// of those, how many are stopped
+	int status;		// of the last stage, once it's reaped
+	struct timespec started;
+	struct timespec finished;
+	struct rusage usage;	// of all its processes, added up as they're reaped (the max RSS is the largest)
+	double launch;		// seconds it took to start them
+	int preforked;		// how many were started by spares
+	struct joblimits *limits;	// NULL if it has none
+};
+struct job *jobs = NULL;
+int numJobs = 0;
+int jobsSize = 0;
+int runningJobs = 0;
+int maxJobs = 0;		// 0 means no limit
+// with -l, the timing and resource use of each job is appended to this CSV file
+FILE *csvLog = NULL;
+
+// children are reaped as soon as they exit: SIGCHLD is blocked and read from a
+//	signalfd, which the shell polls along with its input.  A hash table finds the
+//	job of each pid that is still running (an empty slot has pid 0, one that was
+//	freed has pid -1 so lookups keep probing past it).
+struct pidslot {
+	pid_t pid;
+	int job;
+};
+struct pidslot *pidTable = NULL;
+int pidTableSize = 0;	// a power of 2
+int pidTableUsed = 0;	// slots that aren't empty, freed ones included
+int childFd = -1;
+
+// programs are looked up in PATH once, like bash's hash: a hash table keeps the
+//	absolute path of each program name run, and how many times it was used.  It is
+//	emptied when PATH changes, and a name is looked up again if its path stops
+//	working (an entry that needs that has a NULL path).
+struct cmdslot {
+	char *name;		// NULL for an empty slot
+	char *path;
+	unsigned long hits;
+	pid_t spare;		// its preforked child, or 0
+	int spareFd;		// the socket to the spare
+};
+struct cmdslot *cmdTable = NULL;
+int cmdTableSize = 0;	// a power of 2
+int cmdTableUsed = 0;
+char *cmdPath = NULL;	// the PATH the table was filled from
+
+// with -z, a program that has been run PREFORK_HITS times gets a spare: a child
+//	forked between launches that opens the program and waits on a socket.  Starting
+//	the program is then a message with argv and the stdin, stdout and stderr to
+//	use, which the spare applies after the fork before it execs.  The exec and the
+//	dynamic linking are still the program's own, only the fork and lookup are saved.
+//	A launch is timed to the exec either way: posix_spawn returns after it, and a
+//	spare's close-on-exec status pipe reaches EOF with it (or carries its errno).
+#define PREFORK_HITS 2
+#define PREFORK_MAX 16
+int prefork = 0;
+char *preforkWanted[PREFORK_MAX];	// names of programs to fork a spare for
+int numWanted = 0;
+int numSpares = 0;
+long long spawnCount = 0, preforkCount = 0;	// launches, and the nanoseconds they took
+long long spawnNanos = 0, preforkNanos = 0;
+long long spareNanos = 0;	// time spent forking spares, between launches
+
+// the input is read a block at a time into here, and split into lines
+char inBuffer[MAX_INPUT_CHARS];
+size_t inStart = 0, inEnd = 0;
+char *lineBuffer = NULL;	// grows to fit the longest line
+size_t lineSize = 0;
+
+// each line is split into commands by parse_line.  Everything it makes lives in
+//	an arena that is freed in one go once the line has run; the first chunk is
+//	kept for the next line, so a line normally costs no mallocs at all.
+#define ARENA_CHUNK (64 * 1024)
+struct arenachunk {
+	struct arenachunk *next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+struct arenachunk *arena = NULL;
+// a command is a pipeline of programs, with its redirections
+struct command {
+	char **words;		// NULL-terminated, stages separated by pipeWord
+	int numWords;
+	char *iFile;		// < file for the first stage
+	char *oFile;		// > or >> file for the last stage
+	int oFlags;
+	char *eFile;		// 2> or 2>> file for every stage
+	int eFlags;
+	char *text;		// the command as written, for the job table
+	int afterAnd;		// it follows && rather than ; or the start of the line
+	struct command *next;
+};
+// pmap keeps the state of each run that has started, until its output is shown
+struct pmaprun {
+	pid_t pid;		// 0 once it has been reaped
+	int fd;			// read end of its stdout and stderr, -1 once it's closed
+	int status;
+	char *output;		// what it wrote before its turn to be shown
+	size_t len;
+	size_t size;
+};
+
+// the | between stages.  It is told apart by its address, so a quoted "|" is an argument
+char pipeWord[] = "|";
+
+/// prototypes ///
+int launch_pipeline(char **words, struct command *c, pid_t *pids, struct joblimits *limits);
+pid_t spawn_stage(char **argv, int inFd, int outFd, int errFd);
+pid_t fork_stage(char **argv, int inFd, int outFd, int errFd, struct joblimits *limits, int splice);
+int splice_stage_ok(char **argv, int inPipe, int outPipe);
+void splice_stage(char **argv);
+int splice_all(int inFd, int outFd);
+int is_pipe(int fd);
+int job_add(char *command, pid_t *pids, int numPids, struct timespec *started, struct joblimits *limits);
+int parse_limits(char **words, int numWords, struct joblimits *l);
+int parse_cpus(char *list, cpu_set_t *cpus);
+int limits_prepare(struct joblimits *l, int job);
+void limits_apply(struct joblimits *l);
+void limits_release(struct joblimits *l);
+void limits_report(int job);
+char *cgroup_setup(void);
+int write_file(const char *path, const char *text);
+long read_key(const char *path, const char *key);
+void job_reaped(pid_t pid, int status, struct rusage *usage);
+pid_t wait_one(void);
+char *status_string(int status, char *buffer, size_t len);
+double seconds_between(struct timespec *from, struct timespec *to);
+void print_summary(void);
+void pid_insert(pid_t pid, int job);
+struct pidslot *pid_find(pid_t pid);
+int reap_children(void);
+void report_exit(pid_t pid, int status, struct rusage *usage);
+void print_usage(int job);
+void log_job(int job);
+double cpu_seconds(struct timeval *t);
+char *read_line(int fd, int interactive);
+struct command *parse_line(char *line);
+char *lex_word(char **in, char **out);
+int execute(struct command *c);
+void *arena_alloc(size_t size);
+void arena_free(void);
+char *command_path(const char *name, int count);
+struct cmdslot *command_slot(const char *name);
+unsigned int command_hash(const char *name);
+char *path_search(const char *name);
+void command_clear(void);
+int job_arg(char **words, int numWords, char *usage);
+void foreground(int job);
+int pmap(struct command *c);
+void write_all(int fd, char *buffer, size_t *len);
+pid_t prefork_launch(struct cmdslot *slot, char **argv, int inFd, int outFd, int errFd);
+void prefork_want(struct cmdslot *slot);
+void prefork_refill(void);
+void spare_main(int fd, const char *path);
+void prefork_discard(struct cmdslot *slot);
 
 /// BEGIN MAIN ///
 int main(int argc, char **argv) {
 
-	char input[MAX_INPUT_CHARS];
-	char *words[MAX_WORDS + 1];		//ensure there is a NULL char* at index 100 if a command has 100 words
+	char *line;
+
+	// -f runs a script of commands instead of reading them from the user,
+	//	-j limits how many started jobs run at once, -z keeps spares of programs run often
+	int in = STDIN_FILENO;
+	char *script = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "f:j:l:z")) != -1) {
+		switch (opt) {
+			case 'f':
+				script = optarg;
+				break;
+			case 'j':
+				maxJobs = atoi(optarg);
+				if (maxJobs <= 0) {
+					printf("myshell: Number of jobs must be larger than 0.\n");
+					exit(1);
+				}
+				break;
+			case 'l':
+				if ((csvLog = fopen(optarg, "ae")) == NULL) {
+					printf("myshell: %s: %s\n", optarg, strerror(errno));
+					exit(1);
+				}
+				// a new log starts with the names of the columns
+				if (ftell(csvLog) == 0) fprintf(csvLog, "job,command,status,wall_s,user_s,sys_s,maxrss_kb,minflt,majflt,nvcsw,nivcsw,launch_s,preforked\n");
+				break;
+			case 'z':
+				prefork = 1;
+				break;
+			default:
+				printf("Usage: %s [-f <script>] [-j <jobs>] [-l <csvfile>] [-z]\n", argv[0]);
+				exit(1);
+		}
+	}
+	if (script != NULL && (in = open(script, O_RDONLY | O_CLOEXEC)) < 0) {
+		printf("myshell: %s: %s\n", script, strerror(errno));
+		exit(1);
+	}
 
+	// children that exit are reported through childFd
+	sigset_t childMask;
+	sigemptyset(&childMask);
+	sigaddset(&childMask, SIGCHLD);
+	if (sigprocmask(SIG_BLOCK, &childMask, NULL) != 0 || (childFd = signalfd(-1, &childMask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+		printf("myshell: signalfd: %s\n", strerror(errno));
+		exit(1);
+	}
 	
 	/// ENTER LOOP FOR SHELL ///
 	while (1) {		// note: loop exits on break statements for EOF or exit/quit commands
-	
-		// used only if there is an input or output redirection 
-		char *iFile = NULL;
-		char *oFile = NULL;
 
 		//////////////////////
 		/// GET USER INPUT ///
 		//////////////////////
 
-		// display a prompt
-		printf("myshell>> ");
+		// display a prompt, unless the commands come from a script
+		if (script == NULL) printf("myshell>> ");
 		// flush stdout to ensure the user can see the prompt
 		if (fflush(stdout) != 0) {
 			printf("myshell: fflush: %s\n", strerror(errno));
 			exit(1);
 		}
 
-		// read in the command from the user
-		if (fgets(input, sizeof(input), stdin) == NULL) {
-			if (feof(stdin) != 0) {
-				// have reached EOF
-				printf("\n\n");
+		// read in the command from the user, reporting jobs that finish meanwhile
+		if ((line = read_line(in, script == NULL)) == NULL) {
+			// have reached EOF
+			if (script == NULL) printf("\n\n");
 
-				//// EXITING WHILE LOOP ////
-				break;
-			}
-			else {
-				// error with fgets
-				printf("myshell: fgets: %s\n", strerror(errno));
-				exit(1);
-			}
+			//// EXITING WHILE LOOP ////
+			break;
+		}
+
+
+		//////////////////////////////////
+		/// PARSE AND RUN EACH COMMAND ///
+		//////////////////////////////////
+
+		// a command after && only runs if the one before it succeeded
+		struct command *c = parse_line(line);
+		int status = 0;
+		for ( ; c != NULL && status >= 0; c = c->next) {
+			if (c->afterAnd && status != 0) continue;
+			status = execute(c);
 		}
+		arena_free();
+		if (status < 0) break;
+	}
+
+	// a script's jobs are all waited for, then summed up
+	command_clear();	// ends the spares
+	if (script != NULL) {
+		while (wait_one() > 0) ;
+		print_summary();
+	}
+
+	return 0;
+}
+
 
+/* Function Name: execute
+ * Preconditions: c is a command from parse_line with at least one word
+ * Runs the builtin c names.  Returns 0 if it succeeded, 1 if it failed (for run
+ *		and time, if the last program of the pipeline did), or -1 for quit
+ *		and exit.	*/
+int execute(struct command *c) {
+	char **words = c->words;
+	int numWords = c->numWords;
 
-		///////////////////////
-		/// PARSE THE INPUT ///
-		///////////////////////
+	/*** start -- begin a process that will run concurrently with the shell ***/
+	if (strcmp(words[0], "start") == 0) {
+		// check arg count
+		if (numWords < 2) {
+			printf("myshell: Wrong number of arguments.\n\n");
+			printf("Usage: start [<limits>] <program> [<arg1> <arg2> ...] [| <program> ...]\n\n");
+			return 1;
+		}
+		struct joblimits limits;
+		int first = parse_limits(words, numWords, &limits);
+		if (first < 0) return 1;
 		
-		// extract the command (first word)
-		words[0] = strtok(input, " \t\n");
-		if (words[0] == NULL) {
-			// the user did not enter anything, so display the prompt again
-			continue;
+		// with too many jobs running already, wait for one to finish
+		while (maxJobs > 0 && runningJobs >= maxJobs && wait_one() > 0) ;
+
+		// start a process for each stage of the pipeline
+		pid_t pids[MAX_STAGES];
+		struct timespec started;
+		clock_gettime(CLOCK_MONOTONIC, &started);
+		if (limits_prepare(&limits, numJobs) != 0) return 1;
+		long long preforked = preforkCount;
+		int numStages = launch_pipeline(words + first, c, pids, &limits);
+		struct timespec launched;
+		clock_gettime(CLOCK_MONOTONIC, &launched);
+		int i;
+		for (i = 0; i < numStages; ++i) {
+			printf("myshell: Process %d started.\n", pids[i]);
+		}
+		if (numStages < 0) {
+			limits_release(&limits);
+			return 1;
+		}
+		printf("\n");
+		int job = job_add(c->text, pids, numStages, &started, &limits);
+		jobs[job].launch = seconds_between(&started, &launched);
+		jobs[job].preforked = preforkCount - preforked;
+	}
+
+	/*** wait -- block until a process exits and prints exit status ***/
+	else if (strcmp(words[0], "wait") == 0) {
+		// check arg count
+		if (numWords != 1) {
+			printf("myshell: Too many arguments.\n");
+			printf("Usage: wait\n\n");
+			return 1;
 		}
 
-		// split the rest of the input into words
-		int numWords = 1;
-		int numCmds = 1;
-		for ( ; numWords < MAX_WORDS; ++numWords) {
-			char *temp = strtok(0, " \t\n");
-			
-			// strtok returns NULL when no further tokens, so break from the loop
-			if (temp == NULL) break;
-			// check for outfile
-			else if (temp[0] == '>') {
-				oFile = strtok(temp, ">");
-			} 
-			// check for infile 
-			else if (temp[0] == '<') {
-				iFile = strtok(temp, "<");\
-			}
-			// otherwise it is just a normal command or argument
+		// wait for one process to finish
+		// error - either no processes left or other wait() error
+		if (wait_one() == -1) {
+			if (errno == ECHILD) {
+				printf("myshell: No processes left.\n\n");
+			}
 			else {
-				words[numCmds] = temp;
-				++numCmds;
+				printf("myshell: wait: %s\n\n", strerror(errno));
 			}
+			return 1;
 		}
-		// check if user has too many input words
-		if (numWords == MAX_WORDS) {
-			char *dummy = strtok(0, " \t\n");
-			if (dummy != NULL) {
-				printf("myshell: Too many arguments on the command line. Max is 100.\n");
-				continue;
+	}
+
+	/*** run -- combination fo start and wait, process runs in fg ***/
+	/*** time -- run, then print how long it took and the resources it used ***/
+	else if (strcmp(words[0], "run") == 0 || strcmp(words[0], "time") == 0) {
+		// check arg count
+		if (numWords < 2) {
+			printf("myshell: Wrong number of arguments.\n");
+			printf("Usage: %s [<limits>] <program> [<arg1> <arg2> ...] [| <program> ...]\n\n", words[0]);
+			return 1;
+		}
+		struct joblimits limits;
+		int first = parse_limits(words, numWords, &limits);
+		if (first < 0) return 1;
+
+		// start a process for each stage of the pipeline
+		pid_t pids[MAX_STAGES];
+		struct timespec started;
+		clock_gettime(CLOCK_MONOTONIC, &started);
+		if (limits_prepare(&limits, numJobs) != 0) return 1;
+		long long preforked = preforkCount;
+		int numStages = launch_pipeline(words + first, c, pids, &limits);
+		struct timespec launched;
+		clock_gettime(CLOCK_MONOTONIC, &launched);
+		if (numStages < 0) {
+			limits_release(&limits);
+			return 1;
+		}
+		int job = job_add(c->text, pids, numStages, &started, &limits);
+		jobs[job].launch = seconds_between(&started, &launched);
+		jobs[job].preforked = preforkCount - preforked;
+
+		// wait for all of them, in order; like sh, the last one's status is the job's
+		int i, failed = 0;
+		for (i = 0; i < numStages; ++i) {
+			int status = 0;
+			struct rusage usage;
+			// wait and update status 
+			if (wait4(pids[i], &status, 0, &usage) != pids[i]) {
+				printf("myshell: waitpid: %s.\n\n", strerror(errno));
+			}										
+			else report_exit(pids[i], status, &usage);
+			failed = status != 0;
+		}
+		if (strcmp(words[0], "time") == 0) print_usage(job);
+		return failed;
+	}
+
+	/*** kill -- ends a process, pid of process as arg ***/
+	else if (strcmp(words[0], "kill") == 0) {
+		// check arg count
+		if (numWords != 2) {
+			printf("myshell: Wrong number of arguments.\n");
+			printf("Usage: kill <pid>\n\n");
+			return 1;
+		}
+
+		// is the pid valid? atoi is undefined on a nonnumber string
+		int i;
+		int validPid = 1;
+		for (i =0 ; words[1][i] != '\0'; ++i) {
+			if (!isdigit(words[1][i])) {
+				validPid = 0;
+				printf("myshell: Invalid argument: pid must be an integer.\n");
+				printf("Usage: kill <pid>\n\n");
+				break;
 			}
 		}
+		if (!validPid) return 1;
 
-		words[numCmds] = NULL;
+		// use sigkill
+		if (kill((pid_t)(atoi(words[1])), SIGKILL) != 0) {
+			printf("myshell: kill: %s.\n\n", strerror(errno));
+			return 1;
+		}
+		else {
+			// successfully killed
+			printf("myshell: Process %s killed.\n\n", words[1]);
+		}
+	}
 
+	/*** stop -- stops a process, pid as arg ***/
+	else if (strcmp(words[0], "stop") == 0) {
+		// check arg count
+		if (numWords != 2) {
+			printf("myshell: Wrong number of arguments.\n");
+			printf("Usage: stop <pid>\n\n");
+			return 1;
+		}
 
-		///////////////////////////////
-		/// EXECUTE COMMAND ENTERED ///
-		///////////////////////////////
-		
-		/*** start -- begin a process that will run concurrently with the shell ***/
-		if (strcmp(words[0], "start") == 0) {
-			// check arg count
-			if (numWords < 2) {
-				printf("myshell: Wrong number of arguments.\n\n");
-				printf("Usage: start <program> [<arg1> <arg2> ...]\n\n");
-				continue;
+		// is the pid valid? atoi is undefined on a nonnumber string
+		int i;
+		int validPid = 1;
+		for (i =0 ; words[1][i] != '\0'; ++i) {
+			if (!isdigit(words[1][i])) {
+				validPid = 0;
+				printf("myshell: Invalid argument: pid must be an integer.\n");
+				printf("Usage: stop <pid>\n\n");
+				break;
 			}
-			
-			// fork the process
-			pid_t pid;
-			pid = fork();
-		
-			// error check	
-			if (pid < 0) {
-				printf("myshell: fork: %s.\n\n", strerror(errno));
-				continue;
+		}
+		if (!validPid) return 1;
+
+		// use sigstop
+		if (kill((pid_t)(atoi(words[1])), SIGSTOP) != 0) {
+			printf("myshell: stop: %s.\n\n", strerror(errno));
+			return 1;
+		}
+		else {
+			// successfully stopped
+			printf("myshell: Process %s stopped.\n\n", words[1]);
+		}
+
+	}
+
+	/*** continue -- resumes a stopped process, pid as arg ***/
+	else if (strcmp(words[0], "continue") == 0) {
+		// check arg count
+		if (numWords != 2) {
+			printf("myshell: Wrong number of arguments.\n");
+			printf("Usage: continue <pid>\n\n");
+			return 1;
+		}
+
+		// is the pid valid? atoi is undefined on a nonnumber string
+		int i;
+		int validPid = 1;
+		for (i =0 ; words[1][i] != '\0'; ++i) {
+			if (!isdigit(words[1][i])) {
+				validPid = 0;
+				printf("myshell: Invalid argument: pid must be an integer.\n");
+				printf("Usage: continue <pid>\n\n");
+				break;
 			}
-			// code the child executes
-			else if (pid == 0) {
-				// if input or output direction, take care of this
-				if (iFile != NULL) {
-					int iFd = open(iFile, O_RDONLY);
-					if (iFd < 0) {
-						printf("myshell: open: %s\n\n", strerror(errno));
-						continue;
-					}
-					if (dup2(iFd, STDIN_FILENO) != STDIN_FILENO) {
-						printf("myshell: dup2: %s\n\n", strerror(errno));
-						continue;	
-					}
-				
-				}
-				if (oFile != NULL) {
-					int oFd = open(oFile, O_RDWR | O_CREAT);
-					if (oFd < 0) {
-						printf("myshell: open: %s\n\n", strerror(errno));
-						continue;
-					}
-					if (dup2(oFd, STDOUT_FILENO) != STDOUT_FILENO) {
-						printf("myshell: dup2: %s\n\n", strerror(errno));
-						continue;
-					} 
-				}
+		}
+		if (!validPid) return 1;
+
+		// use sigcont
+		if (kill((pid_t)(atoi(words[1])), SIGCONT) != 0) {
+			printf("myshell: continue: %s.\n\n", strerror(errno));
+			return 1;
+		}
+		else {
+			// successfully continued
+			printf("myshell: Process %s continued.\n\n", words[1]);
+		}
+
+	}
 
-				// exec call
-				if (execvp(words[1], words + 1) < 0) {
-					printf("myshell: execvp: %s.\n\n", strerror(errno));
-					continue;
+	/*** quit/exit -- exits the program ***/
+	else if (strcmp(words[0], "quit") == 0 || strcmp(words[0], "exit") == 0) {
+		// check arg count
+		if (numWords != 1) {
+			printf("myshell: Too many arguments.\n");
+			printf("Usage: %s\n\n", words[0]);
+			return 1;
+		}
+
+		// the shell stops reading commands
+		return -1;
+	}
+
+	/*** jobs -- lists the jobs that haven't finished ***/
+	else if (strcmp(words[0], "jobs") == 0) {
+		// check arg count
+		if (numWords != 1) {
+			printf("myshell: Too many arguments.\n");
+			printf("Usage: jobs\n\n");
+			return 1;
+		}
+
+		int i, k;
+		for (i = 0; i < numJobs; ++i) {
+			if (jobs[i].running == 0) continue;
+			printf("[%d] %s ", i + 1, jobs[i].stopped == jobs[i].running ? "Stopped" : "Running");
+			for (k = 0; k < jobs[i].numPids; ++k) printf("%d ", jobs[i].pids[k]);
+			printf("%s\n", jobs[i].command);
+		}
+		printf("\n");
+	}
+
+	/*** hash -- lists the programs found in PATH, remembers more, or forgets them all ***/
+	else if (strcmp(words[0], "hash") == 0) {
+		if (numWords == 2 && strcmp(words[1], "-r") == 0) {
+			command_clear();
+			return 0;
+		}
+		if (numWords > 1) {
+			int i, failed = 0;
+			for (i = 1; i < numWords; ++i) {
+				if (words[i][0] == '-' || command_path(words[i], 0) == NULL) {
+					printf("myshell: hash: %s: not found\n", words[i]);
+					failed = 1;
 				}
 			}
-			// code the parent executes, pid = child's pid
-			else {
-				printf("myshell: Process %d started.\n\n", pid);
-			}
+			printf("\n");
+			return failed;
+		}
+
+		command_path("", 0);	// empties the table if PATH changed
+		int i, any = 0;
+		for (i = 0; i < cmdTableSize; ++i) {
+			if (cmdTable[i].name == NULL || cmdTable[i].path == NULL) continue;
+			if (!any) printf("hits\tcommand\n");
+			printf("%4lu\t%s\n", cmdTable[i].hits, cmdTable[i].path);
+			any = 1;
+		}
+		if (!any) printf("myshell: hash table empty\n");
+		printf("\n");
+	}
+
+	/*** pmap -- runs a program once for each input, several at a time ***/
+	else if (strcmp(words[0], "pmap") == 0) {
+		return pmap(c);
+	}
+
+	/*** fg -- continues a job if it's stopped and waits for it ***/
+	else if (strcmp(words[0], "fg") == 0) {
+		int job = job_arg(words, numWords, "Usage: fg [<job>]\n\n");
+		if (job < 0) return 1;
+		foreground(job);
+	}
+
+	/*** bg -- continues a stopped job without waiting for it ***/
+	else if (strcmp(words[0], "bg") == 0) {
+		int job = job_arg(words, numWords, "Usage: bg [<job>]\n\n");
+		if (job < 0) return 1;
+		int k;
+		for (k = 0; k < jobs[job].numPids; ++k) kill(jobs[job].pids[k], SIGCONT);
+		printf("myshell: Job %d continued.\n\n", job + 1);
+	}
+
+	// if none of the above, the user entered an invalid command
+	else {
+		printf("myshell: unknown command: %s\n\n", words[0]);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/* Function Name: launch_pipeline
+ * Preconditions: words is the part of command c's words that is the pipeline,
+ *		its stages separated by pipeWord, and limits are applied to every
+ *		process
+ * Starts a process for each stage, each one's stdout connected to the next
+ *		one's stdin by a pipe, and stores their pids in pids.  Programs are
+ *		spawned; only stages the shell runs itself (see splice_stage) and
+ *		those with limits, which the child must take on before it execs, need
+ *		a fork.  Returns the number of processes started, or -1 if none could be.	*/
+int launch_pipeline(char **words, struct command *c, pid_t *pids, struct joblimits *limits) {
+	// split the words into stages where the |'s are
+	char **stages[MAX_STAGES];
+	int numStages = 1;
+	stages[0] = words;
+	int i;
+	for (i = 0; words[i] != NULL; ++i) {
+		if (words[i] != pipeWord) continue;
+		if (numStages == MAX_STAGES) {
+			printf("myshell: Too many programs in the pipeline. Max is %d.\n\n", MAX_STAGES);
+			return -1;
+		}
+		words[i] = NULL;
+		stages[numStages++] = words + i + 1;
+	}
+	for (i = 0; i < numStages; ++i) {
+		if (stages[i][0] == NULL) {
+			printf("myshell: Missing program in the pipeline.\n\n");
+			return -1;
+		}
+	}
+
+	// the files are opened once, here, so an error can say which file it was about
+	int iFd = -1, oFd = -1, eFd = -1;
+	if (c->iFile != NULL && (iFd = open(c->iFile, O_RDONLY | O_CLOEXEC)) < 0) {
+		printf("myshell: open: %s: %s\n\n", c->iFile, strerror(errno));
+		return -1;
+	}
+	if (c->oFile != NULL && (oFd = open(c->oFile, c->oFlags | O_CLOEXEC, 0666)) < 0) {
+		printf("myshell: open: %s: %s\n\n", c->oFile, strerror(errno));
+		if (iFd >= 0) close(iFd);
+		return -1;
+	}
+	if (c->eFile != NULL && (eFd = open(c->eFile, c->eFlags | O_CLOEXEC, 0666)) < 0) {
+		printf("myshell: open: %s: %s\n\n", c->eFile, strerror(errno));
+		if (iFd >= 0) close(iFd);
+		if (oFd >= 0) close(oFd);
+		return -1;
+	}
+
+	// anything still buffered would be printed again by every forked child
+	fflush(stdout);
+
+	int prevRead = -1;	// read end of the pipe from the stage before
+	for (i = 0; i < numStages; ++i) {
+		// the pipe to the next stage, close-on-exec so no program holds the other end open
+		int p[2] = { -1, -1 };
+		if (i < numStages - 1 && pipe2(p, O_CLOEXEC) != 0) {
+			printf("myshell: pipe2: %s\n\n", strerror(errno));
+			break;
+		}
+
+		// the first stage reads the input file, the last writes the output file,
+		//	the others the pipes between them
+		pid_t pid;
+		int inFd = i == 0 ? iFd : prevRead;
+		int outFd = i == numStages - 1 ? oFd : p[1];
+		int inPipe = i > 0 || (iFd < 0 && is_pipe(STDIN_FILENO));
+		int outPipe = i < numStages - 1 || (oFd < 0 && is_pipe(STDOUT_FILENO));
+		// a program is spawned with those as its stdin and stdout
+		int splice = splice_stage_ok(stages[i], inPipe, outPipe);
+		if (!splice && !limits->set) pid = spawn_stage(stages[i], inFd, outFd, eFd);
+		else pid = fork_stage(stages[i], inFd, outFd, eFd, limits, splice);
+		if (pid < 0) {
+			if (p[0] >= 0) close(p[0]);
+			if (p[1] >= 0) close(p[1]);
+			break;
+		}
+
+		// code the parent executes, the pipe ends now belong to the children
+		pids[i] = pid;
+		if (prevRead >= 0) close(prevRead);
+		if (p[1] >= 0) close(p[1]);
+		prevRead = p[0];
+	}
+	if (prevRead >= 0) close(prevRead);
+	if (iFd >= 0) close(iFd);
+	if (oFd >= 0) close(oFd);
+	if (eFd >= 0) close(eFd);
+
+	return i > 0 ? i : -1;
+}
+
+
+/* Function Name: spawn_stage
+ * Preconditions: inFd, outFd and errFd are the pipe ends or files (or -1) to
+ *		use as stdin, stdout and stderr
+ * Spawns the program argv[0] with its stdin, stdout and stderr set up by the
+ *		spawn's file actions.  Returns its pid, or -1 after printing why the
+ *		program couldn't be run.	*/
+pid_t spawn_stage(char **argv, int inFd, int outFd, int errFd) {
+	struct timespec before, after;
+	clock_gettime(CLOCK_MONOTONIC, &before);
+
+	// a program run often is started by its spare, if it has one by now
+	pid_t pid;
+	if (prefork && strchr(argv[0], '/') == NULL && command_path(argv[0], 1) != NULL) {
+		struct cmdslot *slot = command_slot(argv[0]);
+		// a spare whose exec failed falls through, so the error is found and reported as for any program
+		if (slot->spare > 0 && (pid = prefork_launch(slot, argv, inFd, outFd, errFd)) > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &after);
+			++preforkCount;
+			preforkNanos += (after.tv_sec - before.tv_sec) * 1000000000LL + after.tv_nsec - before.tv_nsec;
+			if (slot->hits >= PREFORK_HITS) prefork_want(slot);
+			return pid;
+		}
+		// the count was added for this launch
+		--slot->hits;
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (inFd >= 0) posix_spawn_file_actions_adddup2(&actions, inFd, STDIN_FILENO);
+	if (outFd >= 0) posix_spawn_file_actions_adddup2(&actions, outFd, STDOUT_FILENO);
+	if (errFd >= 0) posix_spawn_file_actions_adddup2(&actions, errFd, STDERR_FILENO);
+
+	// the shell blocks SIGCHLD for its signalfd, the program shouldn't inherit that
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	sigset_t noSignals;
+	sigemptyset(&noSignals);
+	posix_spawnattr_setsigmask(&attr, &noSignals);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+	// the program's path comes from the table, and if it's gone since it's looked up again
+	int err = ENOENT;
+	char *path = command_path(argv[0], 1);
+	if (path != NULL) err = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+	if (err == ENOENT && path != NULL && strchr(argv[0], '/') == NULL) {
+		struct cmdslot *slot = command_slot(argv[0]);
+		prefork_discard(slot);
+		slot->path = NULL;
+		free(path);
+		if ((path = command_path(argv[0], 1)) != NULL) err = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+	}
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	if (err != 0) {
+		printf("myshell: %s: %s.\n\n", argv[0], strerror(err));
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &after);
+	++spawnCount;
+	spawnNanos += (after.tv_sec - before.tv_sec) * 1000000000LL + after.tv_nsec - before.tv_nsec;
+	if (prefork && strchr(argv[0], '/') == NULL) {
+		struct cmdslot *slot = command_slot(argv[0]);
+		if (slot->hits >= PREFORK_HITS) prefork_want(slot);
+	}
+	return pid;
+}
+
+
+/* Function Name: fork_stage
+ * Preconditions: inFd, outFd and errFd are as for spawn_stage
+ * Forks a child that puts itself under limits, sets up its stdin, stdout and
+ *		stderr, and then runs argv: with splice_stage if splice is set, or
+ *		else by execing the program.  An exec that fails is reported back
+ *		through a close-on-exec pipe, so the shell knows it before it returns,
+ *		as with posix_spawn.  Returns the child's pid, or -1 after printing
+ *		why it couldn't be started.	*/
+pid_t fork_stage(char **argv, int inFd, int outFd, int errFd, struct joblimits *limits, int splice) {
+	char *path = NULL;
+	if (!splice && (path = command_path(argv[0], 1)) == NULL) {
+		printf("myshell: %s: %s.\n\n", argv[0], strerror(ENOENT));
+		return -1;
+	}
+	int status[2];
+	if (pipe2(status, O_CLOEXEC) != 0) {
+		printf("myshell: pipe2: %s\n\n", strerror(errno));
+		return -1;
+	}
+
+	// anything still buffered would be printed again by the child
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		printf("myshell: fork: %s.\n\n", strerror(errno));
+		close(status[0]);
+		close(status[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		// the limits come first, so the program is under them from its first instruction
+		close(status[0]);
+		limits_apply(limits);
+		fflush(stdout);
+		sigset_t noSignals;
+		sigemptyset(&noSignals);
+		sigprocmask(SIG_SETMASK, &noSignals, NULL);
+		if ((inFd >= 0 && dup2(inFd, STDIN_FILENO) != STDIN_FILENO) ||
+				(outFd >= 0 && dup2(outFd, STDOUT_FILENO) != STDOUT_FILENO) ||
+				(errFd >= 0 && dup2(errFd, STDERR_FILENO) != STDERR_FILENO)) {
+			int err = errno;
+			write(status[1], &err, sizeof(err));
+			_exit(127);
 		}
+		if (splice) splice_stage(argv);
+		execve(path, argv, environ);
+		int err = errno;
+		write(status[1], &err, sizeof(err));
+		_exit(127);
+	}
+
+	// nothing comes through the pipe if the exec worked
+	close(status[1]);
+	int err;
+	ssize_t got;
+	while ((got = read(status[0], &err, sizeof(err))) < 0 && errno == EINTR) ;
+	close(status[0]);
+	if (got == sizeof(err)) {
+		waitpid(pid, NULL, 0);
+		printf("myshell: %s: %s.\n\n", argv[0], strerror(err));
+		return -1;
+	}
+	return pid;
+}
+
+
+/* Function Name: splice_stage_ok
+ * Returns true if the stage argv can be run by splice_stage, given whether its
+ *		stdin and stdout will be pipes: cat, or tee into a single file, with
+ *		no options and a pipe where splice needs one.	*/
+int splice_stage_ok(char **argv, int inPipe, int outPipe) {
+	int i;
+	for (i = 1; argv[i] != NULL; ++i) {
+		if (argv[i][0] == '-') return 0;
+	}
+
+	// cat of files into the next stage, or of the stage before into a file
+	if (strcmp(argv[0], "cat") == 0) return argv[1] == NULL ? inPipe || outPipe : outPipe;
+	// tee between two stages
+	return strcmp(argv[0], "tee") == 0 && argv[1] != NULL && argv[2] == NULL && inPipe && outPipe;
+}
+
+
+/* Function Name: splice_stage
+ * Preconditions: called in a pipeline stage's child, with stdin and stdout set
+ *		up, and splice_stage_ok said this stage qualifies
+ * Runs cat, or tee into a single file, inside the child instead of exec'ing
+ *		them, moving the data with splice and tee so it never has to be copied
+ *		through user space.  The child exits when the data is all moved.	*/
+void splice_stage(char **argv) {
+	int i;
+
+	if (strcmp(argv[0], "cat") == 0) {
+		if (argv[1] == NULL) _exit(splice_all(STDIN_FILENO, STDOUT_FILENO) == 0 ? 0 : 1);
 
-		/*** wait -- block until a process exits and prints exit status ***/
-		else if (strcmp(words[0], "wait") == 0) {
-			// check arg count
-			if (numWords != 1) {
-				printf("myshell: Too many arguments.\n");
-				printf("Usage: wait\n\n");
+		int status = 0;
+		for (i = 1; argv[i] != NULL; ++i) {
+			int fd = open(argv[i], O_RDONLY);
+			if (fd < 0) {
+				printf("myshell: cat: %s: %s\n", argv[i], strerror(errno));
+				status = 1;
 				continue;
 			}
+			if (splice_all(fd, STDOUT_FILENO) != 0) status = 1;
+			close(fd);
+		}
+		fflush(stdout);
+		_exit(status);
+	}
 
-			// wait for one process to finish
-			pid_t pid;
-			int status;
-			pid = wait(&status);
-			
-			// error - either no processes left or other wait() error
-			if (pid == -1) {
-				if (errno == ECHILD) {
-					printf("myshell: No processes left.\n\n");
-				}
-				else {
-					printf("myshell: wait: %s\n\n", strerror(errno));
+	// tee between two stages: the data is duplicated into the next stage's
+	//	pipe, then moved from the stage before's pipe into the file
+	else {
+		int fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0) {
+			printf("myshell: tee: %s: %s\n", argv[1], strerror(errno));
+			fflush(stdout);
+			_exit(1);
+		}
+		ssize_t len;
+		while ((len = tee(STDIN_FILENO, STDOUT_FILENO, SPLICE_CHUNK, 0)) != 0) {
+			if (len < 0) {
+				if (errno == EINTR) continue;
+				printf("myshell: tee: %s\n", strerror(errno));
+				fflush(stdout);
+				_exit(1);
+			}
+			while (len > 0) {
+				ssize_t moved = splice(STDIN_FILENO, NULL, fd, NULL, len, SPLICE_F_MOVE);
+				if (moved < 0 && errno == EINTR) continue;
+				if (moved <= 0) {
+					printf("myshell: tee: %s: %s\n", argv[1], strerror(errno));
+					fflush(stdout);
+					_exit(1);
 				}
+				len -= moved;
 			}
-			// wait() successful
-			else if (status == 0) printf("myshell: Process %d exited normally with status %d.\n\n", pid, status);
-			else printf("myshell: Process %d exited abnormallly with status %d: %s.\n\n", pid, status, strsignal(status));
 		}
+		_exit(0);
+	}
+}
 
-		/*** run -- combination fo start and wait, process runs in fg ***/
-		else if (strcmp(words[0], "run") == 0) {
-			// check arg count
-			if (numWords < 2) {
-				printf("myshell: Wrong number of arguments.\n");
-				printf("Usage: run <program> [<arg1> <arg2> ...]\n\n");
-				continue;
-			}
 
-			// fork the process
-			pid_t pid;
-			pid = fork();
+/* Function Name: splice_all
+ * Moves everything from inFd to outFd, with splice if one of them is a pipe
+ *		and otherwise through a buffer.  Returns 0, or -1 after printing the
+ *		error.	*/
+int splice_all(int inFd, int outFd) {
+	ssize_t len;
+	while ((len = splice(inFd, NULL, outFd, NULL, SPLICE_CHUNK, SPLICE_F_MOVE)) != 0) {
+		if (len > 0) continue;
+		if (errno == EINTR) continue;
+		if (errno != EINVAL) {
+			printf("myshell: splice: %s\n", strerror(errno));
+			return -1;
+		}
 
-			// error check
-			if (pid < 0) {
-				printf("myshell: fork: %s.\n\n", strerror(errno));
-				continue;
+		// these files can't be spliced, so copy the rest the usual way
+		char buffer[64 * 1024];
+		while ((len = read(inFd, buffer, sizeof(buffer))) != 0) {
+			if (len < 0) {
+				if (errno == EINTR) continue;
+				printf("myshell: read: %s\n", strerror(errno));
+				return -1;
 			}
-			// code the child executes
-			else if (pid == 0) {
-				// if input or output direction, take care of this
-				if (iFile != NULL) {
-					int iFd = open(iFile, O_RDONLY);
-					if (iFd < 0) {
-						printf("myshell: open: %s\n\n", strerror(errno));
-						continue;
-					}
-					if (dup2(iFd, STDIN_FILENO) != STDIN_FILENO) {
-						printf("myshell: dup2: %s\n\n", strerror(errno));
-						continue;	
-					}
-				
-				}
-				if (oFile != NULL) {
-					int oFd = open(oFile, O_RDWR | O_CREAT | O_APPEND);
-					if (oFd < 0) {
-						printf("myshell: open: %s\n\n", strerror(errno));
-						continue;
-					}
-					if (dup2(oFd, STDOUT_FILENO) != STDOUT_FILENO) {
-						printf("myshell: dup2: %s\n\n", strerror(errno));
-						continue;
-					} 
-				}
-
-				// exec call
-				if (execvp(words[1], words + 1) < 0) {
-					printf("myshell: execvp: %s.\n\n", strerror(errno));
-					continue;	
+			ssize_t written = 0;
+			while (written < len) {
+				ssize_t justWrote = write(outFd, buffer + written, len - written);
+				if (justWrote >= 0) written += justWrote;
+				else if (errno != EINTR) {
+					printf("myshell: write: %s\n", strerror(errno));
+					return -1;
 				}
 			}
-			// code the parent executes
-			else {
-				int status = 0;
-				// wait and update status 
-				if (waitpid(pid, &status, 0) != pid) {
-					printf("myshell: waitpid: %s.\n\n", strerror(errno));
-				}										
+		}
+		break;
+	}
+	return 0;
+}
 
-				if (status == 0) printf("myshell: Process %d exited normally with status %d.\n\n", pid, status);
-				else printf("myshell: Process %d exited abnormally with status %d: %s.\n\n", pid, status, strsignal(status));
-			}
+
+/* Function Name: is_pipe
+ * Returns true if fd is a pipe.	*/
+int is_pipe(int fd) {
+	struct stat s;
+	return fstat(fd, &s) == 0 && S_ISFIFO(s.st_mode);
+}
+
+
+/* Function Name: job_add
+ * Preconditions: pids are the numPids processes started for command at time
+ *		started, with limits
+ * Adds a running job to the job table.  Returns its index.	*/
+int job_add(char *command, pid_t *pids, int numPids, struct timespec *started, struct joblimits *limits) {
+	if (numJobs == jobsSize) {
+		jobsSize = jobsSize ? jobsSize * 2 : 64;
+		jobs = realloc(jobs, sizeof(struct job) * jobsSize);
+		if (jobs == NULL) {
+			printf("myshell: realloc: %s\n", strerror(errno));
+			exit(1);
 		}
+	}
 
-		/*** kill -- ends a process, pid of process as arg ***/
-		else if (strcmp(words[0], "kill") == 0) {
-			// check arg count
-			if (numWords != 2) {
-				printf("myshell: Wrong number of arguments.\n");
-				printf("Usage: kill <pid>\n\n");
-				continue;
+	struct job *j = &jobs[numJobs++];
+	if ((j->command = strdup(command)) == NULL) {
+		printf("myshell: strdup: %s\n", strerror(errno));
+		exit(1);
+	}
+	memcpy(j->pids, pids, sizeof(pid_t) * numPids);
+	j->numPids = numPids;
+	j->running = numPids;
+	j->stopped = 0;
+	j->status = 0;
+	int k;
+	for (k = 0; k < numPids; ++k) pid_insert(pids[k], numJobs - 1);
+	j->started = *started;
+	memset(&j->usage, 0, sizeof(j->usage));
+	j->limits = NULL;
+	j->launch = 0;
+	j->preforked = 0;
+	if (limits->set) {
+		if ((j->limits = malloc(sizeof(struct joblimits))) == NULL) {
+			printf("myshell: malloc: %s\n", strerror(errno));
+			exit(1);
+		}
+		*j->limits = *limits;
+	}
+	++runningJobs;
+	return numJobs - 1;
+}
+
+
+/* Function Name: job_reaped
+ * Records that process pid exited with status, having used usage.  The job it
+ *		belongs to is finished once all its processes are, with the last
+ *		stage's status, and is logged then.	*/
+void job_reaped(pid_t pid, int status, struct rusage *usage) {
+	struct pidslot *slot = pid_find(pid);
+	if (slot == NULL) return;
+	struct job *j = &jobs[slot->job];
+	slot->pid = -1;
+
+	timeradd(&j->usage.ru_utime, &usage->ru_utime, &j->usage.ru_utime);
+	timeradd(&j->usage.ru_stime, &usage->ru_stime, &j->usage.ru_stime);
+	if (usage->ru_maxrss > j->usage.ru_maxrss) j->usage.ru_maxrss = usage->ru_maxrss;
+	j->usage.ru_minflt += usage->ru_minflt;
+	j->usage.ru_majflt += usage->ru_majflt;
+	j->usage.ru_nvcsw += usage->ru_nvcsw;
+	j->usage.ru_nivcsw += usage->ru_nivcsw;
+
+	if (pid == j->pids[j->numPids - 1]) j->status = status;
+	if (--j->running == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &j->finished);
+		--runningJobs;
+		if (j->limits != NULL) limits_report(j - jobs);
+		if (csvLog != NULL) log_job(j - jobs);
+	}
+}
+
+
+/* Function Name: wait_one
+ * Blocks until a process exits, prints its exit status and records it in the
+ *		job table.  Returns its pid, or -1 with errno set if wait failed (ECHILD
+ *		if there are no processes left).	*/
+pid_t wait_one(void) {
+	// the only other children are spares, which don't exit by themselves
+	if (runningJobs == 0) {
+		errno = ECHILD;
+		return -1;
+	}
+	int status;
+	struct rusage usage;
+	pid_t pid = wait4(-1, &status, 0, &usage);
+	if (pid == -1) return -1;
+
+	// wait() successful
+	report_exit(pid, status, &usage);
+	return pid;
+}
+
+
+/* Function Name: report_exit
+ * Prints the exit status of process pid and records it in the job table.  The
+ *		status is an exit code or a signal, so only a signal has a name.	*/
+void report_exit(pid_t pid, int status, struct rusage *usage) {
+	char how[64];
+	if (status == 0) printf("myshell: Process %d exited normally with status %d.\n\n", pid, status);
+	else printf("myshell: Process %d %s.\n\n", pid, status_string(status, how, sizeof(how)));
+	job_reaped(pid, status, usage);
+}
+
+
+/* Function Name: print_usage
+ * Prints how long the finished job took and the resources its processes used.	*/
+void print_usage(int job) {
+	struct job *j = &jobs[job];
+	printf("myshell: Job %d took %.3f s, %.3f s user, %.3f s system, max RSS %ld KB, "
+		"%ld minor and %ld major page faults, %ld voluntary and %ld involuntary context switches.\n",
+		job + 1, seconds_between(&j->started, &j->finished), cpu_seconds(&j->usage.ru_utime),
+		cpu_seconds(&j->usage.ru_stime), j->usage.ru_maxrss, j->usage.ru_minflt, j->usage.ru_majflt,
+		j->usage.ru_nvcsw, j->usage.ru_nivcsw);
+	printf("myshell: Starting its %d processes took %.1f us, %d of them by spares.\n\n",
+		j->numPids, j->launch * 1e6, j->preforked);
+}
+
+
+/* Function Name: log_job
+ * Appends a CSV line with the finished job's status, timing and resource use
+ *		to the log.  Quotes in the command line are doubled, as CSV wants.	*/
+void log_job(int job) {
+	struct job *j = &jobs[job];
+	fprintf(csvLog, "%d,\"", job + 1);
+	char *c;
+	for (c = j->command; *c != '\0'; ++c) {
+		if (*c == '"') fputc('"', csvLog);
+		fputc(*c, csvLog);
+	}
+	int status = WIFSIGNALED(j->status) ? 128 + WTERMSIG(j->status) : WEXITSTATUS(j->status);
+	fprintf(csvLog, "\",%d,%.6f,%.6f,%.6f,%ld,%ld,%ld,%ld,%ld,%.6f,%d\n", status, seconds_between(&j->started, &j->finished),
+		cpu_seconds(&j->usage.ru_utime), cpu_seconds(&j->usage.ru_stime), j->usage.ru_maxrss,
+		j->usage.ru_minflt, j->usage.ru_majflt, j->usage.ru_nvcsw, j->usage.ru_nivcsw, j->launch, j->preforked);
+	fflush(csvLog);
+}
+
+
+/* Function Name: cpu_seconds
+ * Returns a CPU time from a rusage in seconds.	*/
+double cpu_seconds(struct timeval *t) {
+	return t->tv_sec + t->tv_usec / 1e6;
+}
+
+
+/* Function Name: reap_children
+ * Reaps every child that has exited since the last call, without blocking,
+ *		and notes the ones that stopped or continued.  Returns the number
+ *		of exits it reported.	*/
+int reap_children(void) {
+	// the signals only say that something happened, waitpid says what
+	struct signalfd_siginfo info;
+	while (read(childFd, &info, sizeof(info)) == sizeof(info)) ;
+
+	int status;
+	struct rusage usage;
+	pid_t pid;
+	int reported = 0;
+	while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			report_exit(pid, status, &usage);
+			++reported;
+			continue;
+		}
+		struct pidslot *slot = pid_find(pid);
+		if (slot != NULL) jobs[slot->job].stopped += WIFSTOPPED(status) ? 1 : -1;
+	}
+	return reported;
+}
+
+
+/* Function Name: pid_insert
+ * Adds pid to the hash table as a process of job, growing the table (and
+ *		dropping freed slots) once it is half used.	*/
+void pid_insert(pid_t pid, int job) {
+	if (2 * (pidTableUsed + 1) > pidTableSize) {
+		struct pidslot *old = pidTable;
+		int oldSize = pidTableSize;
+		// only the live entries move, so it can stay the same size if enough were freed
+		int live = 0, i;
+		for (i = 0; i < oldSize; ++i) live += old[i].pid > 0;
+		pidTableSize = oldSize ? oldSize : 256;
+		while (4 * (live + 1) > pidTableSize) pidTableSize *= 2;
+		if ((pidTable = calloc(pidTableSize, sizeof(struct pidslot))) == NULL) {
+			printf("myshell: calloc: %s\n", strerror(errno));
+			exit(1);
+		}
+		pidTableUsed = 0;
+		for (i = 0; i < oldSize; ++i) {
+			if (old[i].pid > 0) pid_insert(old[i].pid, old[i].job);
+		}
+		free(old);
+	}
+
+	int i = pid & (pidTableSize - 1);
+	while (pidTable[i].pid != 0) i = (i + 1) & (pidTableSize - 1);
+	pidTable[i].pid = pid;
+	pidTable[i].job = job;
+	++pidTableUsed;
+}
+
+
+/* Function Name: pid_find
+ * Returns the hash table slot of pid, or NULL if it isn't a running job's.	*/
+struct pidslot *pid_find(pid_t pid) {
+	if (pidTableSize == 0) return NULL;
+	int i = pid & (pidTableSize - 1);
+	while (pidTable[i].pid != 0) {
+		if (pidTable[i].pid == pid) return &pidTable[i];
+		i = (i + 1) & (pidTableSize - 1);
+	}
+	return NULL;
+}
+
+
+/* Function Name: read_line
+ * Reads the next line from fd, however long it is, like getline.  Until a
+ *		whole line is in, an interactive shell polls the input along with
+ *		childFd, and reports children as they exit; a script reaps them
+ *		between lines.  Returns the line, which is only good until the next
+ *		call, or NULL at the end of the input.	*/
+char *read_line(int fd, int interactive) {
+	size_t len = 0;
+	int eof = 0;
+	prefork_refill();
+	while (1) {
+		reap_children();
+
+		// move what's buffered, up to the end of the line, onto the line
+		char *newline = memchr(inBuffer + inStart, '\n', inEnd - inStart);
+		size_t take = newline ? (size_t)(newline - inBuffer - inStart) + 1 : inEnd - inStart;
+		if (len + take + 1 > lineSize) {
+			lineSize = lineSize ? 2 * lineSize : MAX_INPUT_CHARS;
+			if (lineSize < len + take + 1) lineSize = len + take + 1;
+			if ((lineBuffer = realloc(lineBuffer, lineSize)) == NULL) {
+				printf("myshell: realloc: %s\n", strerror(errno));
+				exit(1);
 			}
+		}
+		memcpy(lineBuffer + len, inBuffer + inStart, take);
+		len += take;
+		lineBuffer[len] = '\0';
+		inStart += take;
+		if (newline != NULL || (eof && len > 0)) return lineBuffer;
+		if (eof) return NULL;
 
-			// is the pid valid? atoi is undefined on a nonnumber string
-			int i;
-			int validPid = 1;
-			for (i =0 ; words[1][i] != '\0'; ++i) {
-				if (!isdigit(words[1][i])) {
-					validPid = 0;
-					printf("myshell: Invalid argument: pid must be an integer.\n");
-					printf("Usage: kill <pid>\n\n");
-					break;
-				}
+		// the buffer is empty now, read some more
+		inStart = inEnd = 0;
+		if (interactive) {
+			struct pollfd fds[2] = { { fd, POLLIN, 0 }, { childFd, POLLIN, 0 } };
+			if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+				printf("myshell: poll: %s\n", strerror(errno));
+				exit(1);
+			}
+			// show the prompt again after any reports
+			if (fds[1].revents && reap_children() > 0) {
+				printf("myshell>> ");
+				fflush(stdout);
 			}
-			if (!validPid) continue;
+			if (!fds[0].revents) continue;
+		}
+		ssize_t justRead = read(fd, inBuffer, sizeof(inBuffer));
+		if (justRead < 0) {
+			if (errno == EINTR) continue;
+			printf("myshell: read: %s\n", strerror(errno));
+			exit(1);
+		}
+		if (justRead == 0) eof = 1;
+		inEnd = justRead;
+	}
+}
+
+
+/* Function Name: parse_line
+ * Preconditions: line is a whole line of input
+ * Splits line into commands in a single pass.  Words are separated by spaces
+ *		and tabs, or by the operators | ; && < > >> 2> and 2>>, and a word
+ *		starting with # begins a comment.  Within a word, \ keeps the next
+ *		character as it is, '...' keeps everything up to the next ', and
+ *		"..." everything up to the next " except that \ keeps a " \ $ or `.
+ *		Returns the commands in order, in the arena, or NULL if there are
+ *		none or after printing a syntax error.	*/
+struct command *parse_line(char *line) {
+	// a word is never longer unquoted, but each one gets a '\0', and there is
+	//	at most a word, a | or the NULL ending a command per character
+	size_t len = strlen(line);
+	char *out = arena_alloc(2 * len + 2);
+	char **words = arena_alloc((len + 2) * sizeof(char *));
+	int numWords = 0;
+
+	struct command *first = NULL, **last = &first;
+	struct command *c = NULL;
+	int afterAnd = 0;	// the next command follows &&
+	char *in = line;
+	while (1) {
+		while (*in == ' ' || *in == '\t' || *in == '\r' || *in == '\n') ++in;
 
-			// use sigkill
-			if (kill((pid_t)(atoi(words[1])), SIGKILL) != 0) {
-				printf("myshell: kill: %s.\n\n", strerror(errno));
+		// ; && or the end of the line finishes a command
+		int end = *in == '\0' || *in == '#';
+		int and = in[0] == '&' && in[1] == '&';
+		if (end || and || *in == ';') {
+			if (c == NULL) {
+				// only the end of the line can come without a command before it
+				if (end && !afterAnd) return first;
+				printf("myshell: syntax error near %s\n\n", end ? "the end of the line" : and ? "&&" : ";");
+				return NULL;
 			}
-			else {
-				// successfully killed
-				printf("myshell: Process %s killed.\n\n", words[1]);
+			if (c->numWords == 0) {
+				printf("myshell: Missing command.\n\n");
+				return NULL;
 			}
+			words[numWords++] = NULL;
+			// the job table shows the command as it was written
+			size_t textLen = in - c->text;
+			while (textLen > 0 && isspace((unsigned char)c->text[textLen - 1])) --textLen;
+			char *text = arena_alloc(textLen + 1);
+			memcpy(text, c->text, textLen);
+			text[textLen] = '\0';
+			c->text = text;
+			*last = c;
+			last = &c->next;
+			c = NULL;
+
+			if (end) return first;
+			afterAnd = and;
+			in += and ? 2 : 1;
+			continue;
 		}
 
-		/*** stop -- stops a process, pid as arg ***/
-		else if (strcmp(words[0], "stop") == 0) {
-			// check arg count
-			if (numWords != 2) {
-				printf("myshell: Wrong number of arguments.\n");
-				printf("Usage: stop <pid>\n\n");
-				continue;
+		if (c == NULL) {
+			c = arena_alloc(sizeof(struct command));
+			memset(c, 0, sizeof(struct command));
+			c->words = words + numWords;
+			c->text = in;
+			c->afterAnd = afterAnd;
+		}
+
+		if (*in == '|') {
+			if (in[1] == '|') {
+				printf("myshell: syntax error near ||\n\n");
+				return NULL;
 			}
+			words[numWords++] = pipeWord;
+			++c->numWords;
+			++in;
+			continue;
+		}
 
-			// is the pid valid? atoi is undefined on a nonnumber string
-			int i;
-			int validPid = 1;
-			for (i =0 ; words[1][i] != '\0'; ++i) {
-				if (!isdigit(words[1][i])) {
-					validPid = 0;
-					printf("myshell: Invalid argument: pid must be an integer.\n");
-					printf("Usage: stop <pid>\n\n");
-					break;
-				}
+		// a redirection is an operator then the file's name, with or without a space
+		char **file = NULL;
+		if (*in == '<') {
+			file = &c->iFile;
+			++in;
+		}
+		else if (in[0] == '>' || (in[0] == '2' && in[1] == '>')) {
+			int err = in[0] == '2';
+			in += err ? 2 : 1;
+			file = err ? &c->eFile : &c->oFile;
+			int *flags = err ? &c->eFlags : &c->oFlags;
+			*flags = O_WRONLY | O_CREAT | O_TRUNC;
+			if (*in == '>') {
+				*flags = O_WRONLY | O_CREAT | O_APPEND;
+				++in;
 			}
-			if (!validPid) continue;
+		}
+		if (file != NULL) {
+			while (*in == ' ' || *in == '\t') ++in;
+			if ((*file = lex_word(&in, &out)) == NULL) return NULL;
+			continue;
+		}
+
+		if ((words[numWords] = lex_word(&in, &out)) == NULL) return NULL;
+		++numWords;
+		++c->numWords;
+	}
+}
+
 
-			// use sigstop
-			if (kill((pid_t)(atoi(words[1])), SIGSTOP) != 0) {
-				printf("myshell: stop: %s.\n\n", strerror(errno));
+/* Function Name: lex_word
+ * Preconditions: *in is where a word should start, *out has room for it
+ * Copies the word at *in to *out without its quotes and escapes, and moves both
+ *		past it.  Returns the copy, or NULL after printing a syntax error if a
+ *		quote isn't closed or there is no word there.	*/
+char *lex_word(char **in, char **out) {
+	char *p = *in, *word = *out, *o = *out;
+	int quoted = 0;		// "" is a word, nothing isn't
+	int unclosed = 0;
+	while (*p != '\0' && strchr(" \t\r\n;|<>", *p) == NULL && !(p[0] == '&' && p[1] == '&')) {
+		if (*p == '\\') {
+			// a \ at the end of the line is dropped
+			if (*++p == '\0' || *p == '\n') continue;
+			*o++ = *p++;
+		}
+		else if (*p == '\'') {
+			char *close = strchr(p + 1, '\'');
+			if (close == NULL) {
+				unclosed = 1;
+				break;
 			}
-			else {
-				// successfully stopped
-				printf("myshell: Process %s stopped.\n\n", words[1]);
+			memcpy(o, p + 1, close - p - 1);
+			o += close - p - 1;
+			p = close + 1;
+			quoted = 1;
+		}
+		else if (*p == '"') {
+			for (++p; *p != '"' && *p != '\0'; *o++ = *p++) {
+				if (p[0] == '\\' && p[1] != '\0' && strchr("\"\\$`", p[1]) != NULL) ++p;
+			}
+			if (*p == '\0') {
+				unclosed = 1;
+				break;
 			}
+			++p;
+			quoted = 1;
+		}
+		else *o++ = *p++;
+	}
+
+	if (unclosed) {
+		printf("myshell: syntax error: unterminated quote\n\n");
+		return NULL;
+	}
+	if (o == word && !quoted) {
+		printf("myshell: syntax error: missing file name\n\n");
+		return NULL;
+	}
+	*o++ = '\0';
+	*in = p;
+	*out = o;
+	return word;
+}
 
+
+/* Function Name: arena_alloc
+ * Returns size bytes from the arena, which are only freed when arena_free
+ *		frees everything at once.	*/
+void *arena_alloc(size_t size) {
+	size = (size + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+	if (arena == NULL || arena->used + size > arena->size) {
+		size_t chunkSize = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+		struct arenachunk *chunk = malloc(sizeof(struct arenachunk) + chunkSize);
+		if (chunk == NULL) {
+			printf("myshell: malloc: %s\n", strerror(errno));
+			exit(1);
 		}
+		chunk->next = arena;
+		chunk->used = 0;
+		chunk->size = chunkSize;
+		arena = chunk;
+	}
+	void *p = arena->data + arena->used;
+	arena->used += size;
+	return p;
+}
 
-		/*** continue -- resumes a stopped process, pid as arg ***/
-		else if (strcmp(words[0], "continue") == 0) {
-			// check arg count
-			if (numWords != 2) {
-				printf("myshell: Wrong number of arguments.\n");
-				printf("Usage: continue <pid>\n\n");
-				continue;
+
+/* Function Name: arena_free
+ * Frees everything in the arena, keeping its first chunk to use again.	*/
+void arena_free(void) {
+	while (arena != NULL && arena->next != NULL) {
+		struct arenachunk *next = arena->next;
+		free(arena);
+		arena = next;
+	}
+	if (arena != NULL) arena->used = 0;
+}
+
+
+/* Function Name: job_arg
+ * Returns the index of the job that words[1] names for fg or bg, or the latest
+ *		unfinished job if there is no words[1].  Prints usage and returns -1
+ *		if the argument is wrong or the job is finished.	*/
+int job_arg(char **words, int numWords, char *usage) {
+	int job = numJobs - 1;
+	if (numWords > 2) {
+		printf("myshell: Too many arguments.\n");
+		printf("%s", usage);
+		return -1;
+	}
+	if (numWords == 2) {
+		char *end;
+		char *num = words[1][0] == '%' ? words[1] + 1 : words[1];
+		job = strtol(num, &end, 10) - 1;
+		if (*num == '\0' || *end != '\0' || job < 0 || job >= numJobs) {
+			printf("myshell: Invalid argument: no such job.\n");
+			printf("%s", usage);
+			return -1;
+		}
+	}
+	else {
+		while (job >= 0 && jobs[job].running == 0) --job;
+	}
+	if (job < 0 || jobs[job].running == 0) {
+		printf("myshell: No such job.\n\n");
+		return -1;
+	}
+	return job;
+}
+
+
+/* Function Name: foreground
+ * Continues the job's processes if they are stopped, then waits until they
+ *		have all exited, or one of them stops again.	*/
+void foreground(int job) {
+	struct job *j = &jobs[job];
+	int k;
+	for (k = 0; k < j->numPids; ++k) {
+		if (pid_find(j->pids[k]) != NULL) kill(j->pids[k], SIGCONT);
+	}
+	j->stopped = 0;
+
+	for (k = 0; k < j->numPids; ++k) {
+		pid_t pid = j->pids[k];
+		if (pid_find(pid) == NULL) continue;	// already reaped
+
+		int status;
+		struct rusage usage;
+		if (wait4(pid, &status, WUNTRACED, &usage) != pid) {
+			printf("myshell: waitpid: %s.\n\n", strerror(errno));
+			return;
+		}
+		if (WIFSTOPPED(status)) {
+			++j->stopped;
+			printf("myshell: Job %d stopped.\n\n", job + 1);
+			return;
+		}
+		report_exit(pid, status, &usage);
+	}
+}
+
+
+/* Function Name: status_string
+ * Writes what a wait status means into buffer, and returns it.	*/
+char *status_string(int status, char *buffer, size_t len) {
+	if (WIFSIGNALED(status)) snprintf(buffer, len, "killed by signal %d (%s)", WTERMSIG(status), strsignal(WTERMSIG(status)));
+	else snprintf(buffer, len, "exited with status %d", WEXITSTATUS(status));
+	return buffer;
+}
+
+
+/* Function Name: seconds_between
+ * Returns the number of seconds from one time to another.	*/
+double seconds_between(struct timespec *from, struct timespec *to) {
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+
+/* Function Name: print_summary
+ * Preconditions: every job has finished
+ * Prints how each job in the table ended and how long it ran, then the totals.	*/
+void print_summary(void) {
+	if (numJobs == 0) return;
+
+	int failed = 0;
+	struct timespec first = jobs[0].started, last = jobs[0].finished;
+	int i;
+	for (i = 0; i < numJobs; ++i) {
+		struct job *j = &jobs[i];
+		char how[64];
+		printf("myshell: Job %d %s after %.3f seconds: %s\n", i + 1, status_string(j->status, how, sizeof(how)),
+			seconds_between(&j->started, &j->finished), j->command);
+		if (j->status != 0) ++failed;
+		if (seconds_between(&last, &j->finished) > 0) last = j->finished;
+	}
+	printf("myshell: %d jobs, %d failed, in %.3f seconds.\n", numJobs, failed, seconds_between(&first, &last));
+
+	// launches by spares against posix_spawn, both up to the exec, and what forking the spares cost
+	if (prefork && preforkCount > 0) {
+		printf("myshell: %lld programs started by spares in %.1f us each", preforkCount, preforkNanos / 1e3 / preforkCount);
+		if (spawnCount > 0) printf(", %lld by posix_spawn in %.1f us each", spawnCount, spawnNanos / 1e3 / spawnCount);
+		printf("; forking the spares took %.3f ms between launches.\n", spareNanos / 1e6);
+	}
+}
+
+
+/* Function Name: parse_limits
+ * Preconditions: words[0] is start, run or time, and numWords is how many words
+ *		there are before the NULL
+ * Reads the limit options that come before the program into l:
+ *		-a <cpus>		CPU affinity, a list like 0-3,6
+ *		-n <nice>		nice value
+ *		-i <class>[:<level>]	IO priority, class 1 realtime, 2 best effort, 3 idle
+ *		-m <bytes>[K|M|G]	memory limit
+ *		-c <percent>		CPU limit, as a share of one CPU
+ *		-t <seconds>		CPU time limit
+ *		Returns the index of the program in words, or -1 after printing the
+ *		usage if an option is wrong.	*/
+int parse_limits(char **words, int numWords, struct joblimits *l) {
+	memset(l, 0, sizeof(*l));
+	l->ioprio = -1;
+
+	// + stops at the program, so its own options are left alone
+	optind = 0;
+	opterr = 0;
+	int opt;
+	char *end;
+	while ((opt = getopt(numWords, words, "+a:n:i:m:c:t:")) != -1) {
+		l->set = 1;
+		switch (opt) {
+			case 'a':
+				l->hasCpus = 1;
+				if (parse_cpus(optarg, &l->cpus) == 0) continue;
+				break;
+			case 'n':
+				l->hasNice = 1;
+				l->nice = strtol(optarg, &end, 10);
+				if (*optarg != '\0' && *end == '\0') continue;
+				break;
+			case 'i': {
+				long ioClass = strtol(optarg, &end, 10), level = 4;
+				if (*end == ':') level = strtol(end + 1, &end, 10);
+				l->ioprio = ioClass << IOPRIO_CLASS_SHIFT | level;
+				if (*end == '\0' && ioClass >= 1 && ioClass <= 3 && level >= 0 && level <= 7) continue;
+				break;
 			}
+			case 'm':
+				l->memory = strtoull(optarg, &end, 10);
+				if (*end == 'K' || *end == 'k') l->memory <<= 10, ++end;
+				else if (*end == 'M' || *end == 'm') l->memory <<= 20, ++end;
+				else if (*end == 'G' || *end == 'g') l->memory <<= 30, ++end;
+				if (*end == '\0' && l->memory > 0) continue;
+				break;
+			case 'c':
+				l->cpuPercent = strtol(optarg, &end, 10);
+				if (*end == '\0' && l->cpuPercent > 0) continue;
+				break;
+			case 't':
+				l->cpuSeconds = strtol(optarg, &end, 10);
+				if (*end == '\0' && l->cpuSeconds > 0) continue;
+				break;
+		}
+		printf("myshell: Invalid limit.\n");
+		printf("Usage: %s [-a <cpus>] [-n <nice>] [-i <class>[:<level>]] [-m <bytes>[K|M|G]] [-c <percent>] [-t <seconds>] <program> ...\n\n", words[0]);
+		return -1;
+	}
+
+	if (words[optind] == NULL) {
+		printf("myshell: Wrong number of arguments.\n");
+		printf("Usage: %s [<limits>] <program> [<arg1> <arg2> ...] [| <program> ...]\n\n", words[0]);
+		return -1;
+	}
+	return optind;
+}
+
+
+/* Function Name: parse_cpus
+ * Reads a list of CPUs and ranges of CPUs, like 0-3,6, into cpus.  Returns 0,
+ *		or -1 if the list is wrong.	*/
+int parse_cpus(char *list, cpu_set_t *cpus) {
+	CPU_ZERO(cpus);
+	char *p = list;
+	while (*p != '\0') {
+		char *end;
+		long first = strtol(p, &end, 10), last = first;
+		if (end == p) return -1;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p) return -1;
+		}
+		if (first < 0 || last < first || last >= CPU_SETSIZE) return -1;
+		for ( ; first <= last; ++first) CPU_SET(first, cpus);
+		if (*end == ',') ++end;
+		else if (*end != '\0') return -1;
+		p = end;
+	}
+	return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+
+/* Function Name: limits_prepare
+ * Preconditions: l are the limits of the job that will get index job
+ * Makes the job's cgroup if it has a memory or CPU limit, with those limits
+ *		set.  If cgroups can't be used, the memory limit becomes an
+ *		RLIMIT_AS and the CPU limit is dropped, which it says.  Returns 0, or
+ *		-1 after printing why the job can't be started.	*/
+int limits_prepare(struct joblimits *l, int job) {
+	if (l->memory == 0 && l->cpuPercent == 0) return 0;
+
+	char *base = cgroup_setup();
+	if (base != NULL) {
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/job%d", base, job + 1);
+		if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+			printf("myshell: mkdir: %s: %s\n\n", path, strerror(errno));
+			return -1;
+		}
+
+		char file[PATH_MAX + 32], value[64];
+		int err = 0;
+		if (l->memory > 0) {
+			snprintf(file, sizeof(file), "%s/memory.max", path);
+			snprintf(value, sizeof(value), "%llu", l->memory);
+			err |= write_file(file, value);
+			// without this the kernel swaps the job out rather than stopping it at the limit
+			snprintf(file, sizeof(file), "%s/memory.swap.max", path);
+			write_file(file, "0");
+		}
+		if (l->cpuPercent > 0) {
+			snprintf(file, sizeof(file), "%s/cpu.max", path);
+			snprintf(value, sizeof(value), "%d 100000", l->cpuPercent * 1000);
+			err |= write_file(file, value);
+		}
+		if (err == 0 && (l->cgroup = strdup(path)) != NULL) return 0;
+		rmdir(path);
+	}
+
+	if (l->cpuPercent > 0) printf("myshell: cgroup v2 is not writable, so the CPU limit is ignored.\n");
+	return 0;
+}
+
+
+/* Function Name: limits_release
+ * Removes the cgroup limits_prepare made for l, if it made one.  The cgroup
+ *		must be empty by then: its job has finished, or never started.	*/
+void limits_release(struct joblimits *l) {
+	if (l->cgroup == NULL) return;
+	rmdir(l->cgroup);
+	free(l->cgroup);
+	l->cgroup = NULL;
+}
+
+
+/* Function Name: limits_apply
+ * Preconditions: this is a child of the shell that hasn't exec'd yet
+ * Puts this process under the limits l.  Failures are printed, and the
+ *		process goes on without that limit.	*/
+void limits_apply(struct joblimits *l) {
+	if (!l->set) return;
+
+	// moving into the job's group first charges everything the program uses to it
+	if (l->cgroup != NULL) {
+		char file[PATH_MAX + 32], value[32];
+		snprintf(file, sizeof(file), "%s/cgroup.procs", l->cgroup);
+		snprintf(value, sizeof(value), "%d", getpid());
+		if (write_file(file, value) != 0) printf("myshell: %s: %s\n", file, strerror(errno));
+	}
+	else if (l->memory > 0) {
+		struct rlimit memory = { l->memory, l->memory };
+		if (setrlimit(RLIMIT_AS, &memory) != 0) printf("myshell: setrlimit: %s\n", strerror(errno));
+	}
+
+	if (l->hasCpus && sched_setaffinity(0, sizeof(cpu_set_t), &l->cpus) != 0) {
+		printf("myshell: sched_setaffinity: %s\n", strerror(errno));
+	}
+	if (l->hasNice && setpriority(PRIO_PROCESS, 0, l->nice) != 0) {
+		printf("myshell: setpriority: %s\n", strerror(errno));
+	}
+	if (l->ioprio >= 0 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, l->ioprio) != 0) {
+		printf("myshell: ioprio_set: %s\n", strerror(errno));
+	}
+	// the soft limit sends SIGXCPU, the hard one a second later SIGKILL
+	if (l->cpuSeconds > 0) {
+		struct rlimit cpu = { l->cpuSeconds, l->cpuSeconds + 1 };
+		if (setrlimit(RLIMIT_CPU, &cpu) != 0) printf("myshell: setrlimit: %s\n", strerror(errno));
+	}
+}
+
+
+/* Function Name: limits_report
+ * Preconditions: the job has finished, and has limits
+ * Says if the job ran into its limits: OOM kills and CPU throttling counted by
+ *		its cgroup, or the signal a CPU time limit sends.  Then removes the
+ *		job's cgroup.	*/
+void limits_report(int job) {
+	struct job *j = &jobs[job];
+	struct joblimits *l = j->limits;
+
+	if (l->cpuSeconds > 0 && WIFSIGNALED(j->status) && (WTERMSIG(j->status) == SIGXCPU || WTERMSIG(j->status) == SIGKILL)) {
+		printf("myshell: Job %d hit its CPU time limit of %ld seconds.\n\n", job + 1, l->cpuSeconds);
+	}
+	if (l->cgroup != NULL) {
+		char file[PATH_MAX + 32];
+		snprintf(file, sizeof(file), "%s/memory.events", l->cgroup);
+		long oomKills = l->memory > 0 ? read_key(file, "oom_kill") : 0;
+		if (oomKills > 0) printf("myshell: Job %d hit its memory limit of %llu bytes: %ld processes killed.\n\n", job + 1, l->memory, oomKills);
+		snprintf(file, sizeof(file), "%s/cpu.stat", l->cgroup);
+		long throttled = l->cpuPercent > 0 ? read_key(file, "nr_throttled") : 0;
+		if (throttled > 0) printf("myshell: Job %d hit its CPU limit of %d%%: throttled %ld times.\n\n", job + 1, l->cpuPercent, throttled);
+		limits_release(l);
+	}
+	// an address space limit only shows as failed allocations
+	else if (l->memory > 0 && j->status != 0) {
+		printf("myshell: Job %d failed with its address space limited to %llu bytes.\n\n", job + 1, l->memory);
+	}
+}
 
-			// is the pid valid? atoi is undefined on a nonnumber string
-			int i;
-			int validPid = 1;
-			for (i =0 ; words[1][i] != '\0'; ++i) {
-				if (!isdigit(words[1][i])) {
-					validPid = 0;
-					printf("myshell: Invalid argument: pid must be an integer.\n");
-					printf("Usage: continue <pid>\n\n");
-					break;
+
+/* Function Name: cgroup_setup
+ * Returns the cgroup v2 directory the job groups go in, making it the first
+ *		time: a myshell.<pid> group under the shell's own, with the memory and
+ *		cpu controllers enabled for its children.  Returns NULL if there is
+ *		no cgroup v2 mount or the shell isn't allowed to do that.	*/
+char *cgroup_setup(void) {
+	if (cgroupTried) return cgroupBase;
+	cgroupTried = 1;
+
+	// where cgroup2 is mounted...
+	char mount[PATH_MAX] = "";
+	char line[PATH_MAX * 2];
+	FILE *f = fopen("/proc/self/mountinfo", "r");
+	if (f == NULL) return NULL;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char point[PATH_MAX], *type = strstr(line, " - cgroup2 ");
+		if (type != NULL && sscanf(line, "%*s %*s %*s %*s %s", point) == 1) {
+			strcpy(mount, point);
+			break;
+		}
+	}
+	fclose(f);
+
+	// ... and which group in it the shell is in
+	char own[PATH_MAX] = "";
+	if ((f = fopen("/proc/self/cgroup", "r")) == NULL) return NULL;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, "0::", 3) != 0) continue;
+		line[strcspn(line, "\n")] = '\0';
+		snprintf(own, sizeof(own), "%s", line + 3);
+	}
+	fclose(f);
+	if (mount[0] == '\0' || own[0] == '\0') return NULL;
+
+	char path[PATH_MAX * 2], file[PATH_MAX * 2 + 32];
+	snprintf(path, sizeof(path), "%s%s", mount, strcmp(own, "/") == 0 ? "" : own);
+	snprintf(file, sizeof(file), "%s/cgroup.subtree_control", path);
+	if (write_file(file, "+memory +cpu") != 0) return NULL;
+	snprintf(path + strlen(path), sizeof(path) - strlen(path), "/myshell.%d", getpid());
+	if (mkdir(path, 0755) != 0 && errno != EEXIST) return NULL;
+	snprintf(file, sizeof(file), "%s/cgroup.subtree_control", path);
+	if (write_file(file, "+memory +cpu") != 0) {
+		rmdir(path);
+		return NULL;
+	}
+
+	cgroupBase = strdup(path);
+	return cgroupBase;
+}
+
+
+/* Function Name: write_file
+ * Writes text to the file at path, as for a cgroup's control files.  Returns
+ *		0, or -1 with errno set.	*/
+int write_file(const char *path, const char *text) {
+	int fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+	ssize_t len = strlen(text);
+	int ok = write(fd, text, len) == len;
+	int err = errno;
+	close(fd);
+	errno = err;
+	return ok ? 0 : -1;
+}
+
+
+/* Function Name: read_key
+ * Returns the number after key in a file of "key value" lines, like a cgroup's
+ *		memory.events, or 0 if it isn't there.	*/
+long read_key(const char *path, const char *key) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) return 0;
+	char name[64];
+	long value, found = 0;
+	while (fscanf(f, "%63s %ld", name, &value) == 2) {
+		if (strcmp(name, key) == 0) found = value;
+	}
+	fclose(f);
+	return found;
+}
+
+
+/* Function Name: command_path
+ * Returns the path to run the program name from: name itself if it has a /,
+ *		or else its path in the hash table, searching PATH for it if it isn't
+ *		there yet.  count adds a hit.  Returns NULL if it isn't in PATH.	*/
+char *command_path(const char *name, int count) {
+	// a different PATH could find different programs
+	char *path = getenv("PATH");
+	if (path == NULL) path = "/bin:/usr/bin";
+	if (cmdPath == NULL || strcmp(cmdPath, path) != 0) {
+		command_clear();
+		if ((cmdPath = strdup(path)) == NULL) {
+			printf("myshell: strdup: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+	if (strchr(name, '/') != NULL || name[0] == '\0') return (char *)name;
+
+	struct cmdslot *slot = command_slot(name);
+	if (slot->path == NULL) {
+		if ((slot->path = path_search(name)) == NULL) return NULL;
+		slot->hits = 0;
+	}
+	slot->hits += count;
+	return slot->path;
+}
+
+
+/* Function Name: command_slot
+ * Returns the hash table slot of name, adding it with no path if it isn't in
+ *		the table, which grows once it is half used.	*/
+struct cmdslot *command_slot(const char *name) {
+	if (2 * (cmdTableUsed + 1) > cmdTableSize) {
+		struct cmdslot *old = cmdTable;
+		int oldSize = cmdTableSize, i;
+		cmdTableSize = oldSize ? 2 * oldSize : 64;
+		if ((cmdTable = calloc(cmdTableSize, sizeof(struct cmdslot))) == NULL) {
+			printf("myshell: calloc: %s\n", strerror(errno));
+			exit(1);
+		}
+		for (i = 0; i < oldSize; ++i) {
+			if (old[i].name == NULL) continue;
+			int k = command_hash(old[i].name) & (cmdTableSize - 1);
+			while (cmdTable[k].name != NULL) k = (k + 1) & (cmdTableSize - 1);
+			cmdTable[k] = old[i];
+		}
+		free(old);
+	}
+
+	int i = command_hash(name) & (cmdTableSize - 1);
+	while (cmdTable[i].name != NULL) {
+		if (strcmp(cmdTable[i].name, name) == 0) return &cmdTable[i];
+		i = (i + 1) & (cmdTableSize - 1);
+	}
+	if ((cmdTable[i].name = strdup(name)) == NULL) {
+		printf("myshell: strdup: %s\n", strerror(errno));
+		exit(1);
+	}
+	cmdTable[i].path = NULL;
+	cmdTable[i].hits = 0;
+	++cmdTableUsed;
+	return &cmdTable[i];
+}
+
+
+/* Function Name: command_hash
+ * Returns the FNV-1a hash of name.	*/
+unsigned int command_hash(const char *name) {
+	unsigned int hash = 2166136261u;
+	for ( ; *name != '\0'; ++name) hash = (hash ^ (unsigned char)*name) * 16777619u;
+	return hash;
+}
+
+
+/* Function Name: path_search
+ * Returns the first executable file called name in the directories of PATH,
+ *		in memory from malloc, or NULL if there isn't one.	*/
+char *path_search(const char *name) {
+	const char *dir = cmdPath;
+	char file[PATH_MAX];
+	while (1) {
+		size_t len = strcspn(dir, ":");
+		// an empty directory in PATH is the current one
+		if (len == 0) snprintf(file, sizeof(file), "./%s", name);
+		else snprintf(file, sizeof(file), "%.*s/%s", (int)len, dir, name);
+
+		struct stat info;
+		if (stat(file, &info) == 0 && S_ISREG(info.st_mode) && access(file, X_OK) == 0) {
+			char *found = strdup(file);
+			if (found == NULL) {
+				printf("myshell: strdup: %s\n", strerror(errno));
+				exit(1);
+			}
+			return found;
+		}
+
+		if (dir[len] == '\0') return NULL;
+		dir += len + 1;
+	}
+}
+
+
+/* Function Name: command_clear
+ * Empties the program hash table, ending any spares.	*/
+void command_clear(void) {
+	int i;
+	numWanted = 0;
+	for (i = 0; i < cmdTableSize; ++i) {
+		prefork_discard(&cmdTable[i]);
+		free(cmdTable[i].name);
+		free(cmdTable[i].path);
+	}
+	free(cmdTable);
+	cmdTable = NULL;
+	cmdTableSize = cmdTableUsed = 0;
+	free(cmdPath);
+	cmdPath = NULL;
+}
+
+/* Function Name: pmap
+ * Preconditions: c is a pmap command:
+ *		pmap [-j <procs>] [-r <first>..<last>] <program> [<arg> ...] [::: <input> ...]
+ * Runs the program once for each input, either the words after ::: or the
+ *		numbers from first to last, with up to procs (by default, one per CPU)
+ *		running at once.  Each {} in the arguments becomes the input, or it
+ *		is added as the last argument if there are none.  Every run is a job,
+ *		with its stdout and stderr going to a pipe the shell reads, so each
+ *		run's output comes out whole and in order: the oldest unfinished run
+ *		is shown as it writes, and the others are kept until their turn.
+ *		Like mandelmovie, it stops at the first run that fails, killing the
+ *		others.  Returns 0, or 1 if a run failed.	*/
+int pmap(struct command *c) {
+	char **words = c->words;
+	long procs = sysconf(_SC_NPROCESSORS_ONLN);
+	long first = 0, last = -1;
+	int range = 0;
+
+	optind = 0;
+	opterr = 0;
+	int opt, bad = 0;
+	while ((opt = getopt(c->numWords, words, "+j:r:")) != -1) {
+		char *end;
+		if (opt == 'j') {
+			procs = strtol(optarg, &end, 10);
+			bad |= *end != '\0' || procs <= 0;
+		}
+		else if (opt == 'r') {
+			int len = 0;
+			range = 1;
+			bad |= sscanf(optarg, "%ld..%ld%n", &first, &last, &len) != 2 || optarg[len] != '\0';
+		}
+		else bad = 1;
+	}
+
+	// the program and its arguments run up to :::, the inputs come after it
+	char **program = words + optind;
+	int numArgs = 0;
+	while (program[numArgs] != NULL && strcmp(program[numArgs], ":::") != 0) ++numArgs;
+	char **inputs = program[numArgs] != NULL ? program + numArgs + 1 : NULL;
+	long numInputs = range ? labs(last - first) + 1 : 0;
+	if (inputs != NULL) while (inputs[numInputs] != NULL) ++numInputs;
+	if (bad || numArgs == 0 || range == (inputs != NULL)) {
+		printf("myshell: Invalid arguments.\n");
+		printf("Usage: pmap [-j <procs>] [-r <first>..<last>] <program> [<arg> ...] [::: <input> ...]\n\n");
+		return 1;
+	}
+	int i, k, placeholder = 0;
+	for (i = 0; i < numArgs; ++i) {
+		if (program[i] == pipeWord) {
+			printf("myshell: pmap runs a single program, not a pipeline.\n\n");
+			return 1;
+		}
+		placeholder |= strstr(program[i], "{}") != NULL;
+	}
+
+	int inFd = -1, outFd = STDOUT_FILENO;
+	if (c->iFile != NULL && (inFd = open(c->iFile, O_RDONLY | O_CLOEXEC)) < 0) {
+		printf("myshell: open: %s: %s\n\n", c->iFile, strerror(errno));
+		return 1;
+	}
+	if (c->oFile != NULL && (outFd = open(c->oFile, c->oFlags | O_CLOEXEC, 0666)) < 0) {
+		printf("myshell: open: %s: %s\n\n", c->oFile, strerror(errno));
+		if (inFd >= 0) close(inFd);
+		return 1;
+	}
+
+	// runs are kept in a ring, so at most window of them wait for their output to be shown
+	int window = 4 * procs;
+	struct pmaprun *runs = calloc(window, sizeof(struct pmaprun));
+	struct pollfd *fds = calloc(window + 1, sizeof(struct pollfd));
+	int *polled = calloc(window, sizeof(int));
+	char **argv = malloc((numArgs + 2) * sizeof(char *));
+	if (runs == NULL || fds == NULL || polled == NULL || argv == NULL) {
+		printf("myshell: malloc: %s\n", strerror(errno));
+		exit(1);
+	}
+	char *args = NULL;	// argv's strings, then the command as the job table shows it
+	size_t argsSize = 0;
+	char number[32];
+	struct joblimits noLimits;
+	memset(&noLimits, 0, sizeof(noLimits));
+	noLimits.ioprio = -1;
+
+	struct timespec started, finished;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+	fflush(stdout);
+	long next = 0, head = 0;
+	int running = 0;
+	long failed = -1;	// the input whose run failed
+	int failedStatus = 0;
+	while (head < next || (next < numInputs && failed < 0)) {
+		// start runs while there is room
+		while (failed < 0 && next < numInputs && running < procs && next < head + window) {
+			char *input = inputs != NULL ? inputs[next] : number;
+			if (inputs == NULL) snprintf(number, sizeof(number), "%ld", first + (last >= first ? next : -next));
+
+			// the arguments with {} replaced, each followed by a '\0', then the
+			//	same separated by spaces
+			size_t need = 0;
+			for (i = 0; i < numArgs; ++i) {
+				char *at;
+				need += strlen(program[i]) + 1;
+				for (at = strstr(program[i], "{}"); at != NULL; at = strstr(at + 2, "{}")) need += strlen(input);
+			}
+			need = 2 * (need + strlen(input) + 1);
+			if (need > argsSize) {
+				argsSize = need;
+				if ((args = realloc(args, argsSize)) == NULL) {
+					printf("myshell: realloc: %s\n", strerror(errno));
+					exit(1);
 				}
 			}
-			if (!validPid) continue;
+			char *o = args;
+			for (i = 0; i < numArgs; ++i) {
+				argv[i] = o;
+				char *from = program[i], *at;
+				while ((at = strstr(from, "{}")) != NULL) {
+					o += sprintf(o, "%.*s%s", (int)(at - from), from, input);
+					from = at + 2;
+				}
+				o += sprintf(o, "%s", from) + 1;
+			}
+			if (!placeholder) {
+				argv[i++] = o;
+				o += sprintf(o, "%s", input) + 1;
+			}
+			argv[i] = NULL;
+			char *text = o;
+			for (k = 0; k < i; ++k) o += sprintf(o, k ? " %s" : "%s", argv[k]);
 
-			// use sigcont
-			if (kill((pid_t)(atoi(words[1])), SIGCONT) != 0) {
-				printf("myshell: continue: %s.\n\n", strerror(errno));
+			struct pmaprun *r = &runs[next % window];
+			int p[2];
+			if (pipe2(p, O_CLOEXEC) != 0) {
+				printf("myshell: pipe2: %s\n\n", strerror(errno));
+				failed = next;
+				break;
 			}
-			else {
-				// successfully continued
-				printf("myshell: Process %s continued.\n\n", words[1]);
+			struct timespec runStarted, launched;
+			clock_gettime(CLOCK_MONOTONIC, &runStarted);
+			long long preforked = preforkCount;
+			r->pid = spawn_stage(argv, inFd, p[1], p[1]);
+			clock_gettime(CLOCK_MONOTONIC, &launched);
+			close(p[1]);
+			if (r->pid < 0) {
+				close(p[0]);
+				failed = next;
+				break;
 			}
+			r->fd = p[0];
+			r->len = 0;
+			r->status = 0;
+			int job = job_add(text, &r->pid, 1, &runStarted, &noLimits);
+			jobs[job].launch = seconds_between(&runStarted, &launched);
+			jobs[job].preforked = preforkCount - preforked;
+			prefork_refill();
+			++running;
+			++next;
+		}
+		if (head == next) break;
 
+		// wait for output, or for runs to exit
+		int numFds = 0;
+		for (i = 0; i < next - head; ++i) {
+			struct pmaprun *r = &runs[(head + i) % window];
+			if (r->fd < 0) continue;
+			fds[numFds].fd = r->fd;
+			fds[numFds].events = POLLIN;
+			polled[numFds++] = i;
+		}
+		fds[numFds].fd = childFd;
+		fds[numFds].events = POLLIN;
+		if (poll(fds, numFds + 1, -1) < 0 && errno != EINTR) {
+			printf("myshell: poll: %s\n", strerror(errno));
+			exit(1);
 		}
 
-		/*** quit/exit -- exits the program ***/
-		else if (strcmp(words[0], "quit") == 0 || strcmp(words[0], "exit") == 0) {
-			// check arg count
-			if (numWords != 1) {
-				printf("myshell: Too many arguments.\n");
-				printf("Usage: %s\n\n", words[0]);
+		// the oldest run's output goes straight out, the others' is kept
+		for (k = 0; k < numFds; ++k) {
+			if (fds[k].revents == 0) continue;
+			struct pmaprun *r = &runs[(head + polled[k]) % window];
+			if (r->len + SPLICE_CHUNK / 16 > r->size) {
+				r->size = r->size ? 2 * r->size : SPLICE_CHUNK / 16;
+				if ((r->output = realloc(r->output, r->size)) == NULL) {
+					printf("myshell: realloc: %s\n", strerror(errno));
+					exit(1);
+				}
+			}
+			ssize_t justRead = read(r->fd, r->output + r->len, r->size - r->len);
+			if (justRead <= 0) {
+				if (justRead < 0 && errno == EINTR) continue;
+				close(r->fd);
+				r->fd = -1;
 				continue;
 			}
+			r->len += justRead;
+			if (polled[k] == 0) write_all(outFd, r->output, &r->len);
+		}
 
-			//// EXITING WHILE LOOP ////
-			break;	
+		if (fds[numFds].revents) {
+			struct signalfd_siginfo info;
+			while (read(childFd, &info, sizeof(info)) == sizeof(info)) ;
+			for (i = 0; i < next - head; ++i) {
+				struct pmaprun *r = &runs[(head + i) % window];
+				struct rusage usage;
+				if (r->pid <= 0 || wait4(r->pid, &r->status, WNOHANG, &usage) != r->pid) continue;
+				job_reaped(r->pid, r->status, &usage);
+				r->pid = 0;
+				--running;
+				// one stopped by a failure may have left children holding its pipe open
+				if (failed >= 0 && r->status != 0 && r->fd >= 0) {
+					close(r->fd);
+					r->fd = -1;
+				}
+				if (r->status == 0 || failed >= 0) continue;
+
+				// fail fast: no more are started, and the ones running are stopped
+				failed = head + i;
+				failedStatus = r->status;
+				for (k = 0; k < next - head; ++k) {
+					if (runs[(head + k) % window].pid > 0) kill(runs[(head + k) % window].pid, SIGTERM);
+				}
+			}
 		}
 
-		// if none of the above, the user entered an invalid command
-		else {
-			printf("myshell: unknown command: %s\n\n", words[0]);
+		// once the oldest run is done, the next one's output is shown
+		while (head < next && runs[head % window].fd < 0 && runs[head % window].pid == 0) {
+			++head;
+			if (head < next) write_all(outFd, runs[head % window].output, &runs[head % window].len);
 		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &finished);
+
+	if (failed >= 0 && failedStatus != 0) {
+		char how[64];
+		if (inputs == NULL) snprintf(number, sizeof(number), "%ld", first + (last >= first ? failed : -failed));
+		printf("myshell: pmap: The run for %s %s, so the others were stopped.\n\n",
+			inputs != NULL ? inputs[failed] : number, status_string(failedStatus, how, sizeof(how)));
+	}
+	else if (failed < 0) {
+		printf("myshell: pmap: %ld runs finished in %.3f seconds.\n\n", numInputs, seconds_between(&started, &finished));
+	}
+
+	for (i = 0; i < window; ++i) free(runs[i].output);
+	free(runs);
+	free(fds);
+	free(polled);
+	free(argv);
+	free(args);
+	if (inFd >= 0) close(inFd);
+	if (outFd != STDOUT_FILENO) close(outFd);
+	return failed >= 0;
+}
 
+
+/* Function Name: write_all
+ * Writes the len bytes at buffer to fd, and sets len to 0.	*/
+void write_all(int fd, char *buffer, size_t *len) {
+	size_t done = 0;
+	while (done < *len) {
+		ssize_t justWritten = write(fd, buffer + done, *len - done);
+		if (justWritten < 0) {
+			if (errno == EINTR) continue;
+			printf("myshell: write: %s\n", strerror(errno));
+			break;
+		}
+		done += justWritten;
 	}
+	*len = 0;
+}
 
-	return 0;
+/* Function Name: prefork_launch
+ * Preconditions: slot has a spare
+ * Starts argv with the spare of slot, sending it argv and the stdin, stdout and
+ *		stderr to use (the shell's own in place of any that are -1), and the
+ *		write end of a close-on-exec status pipe.  Waits for that pipe to
+ *		close, which is when the exec is done.  Returns the spare's pid, or -1
+ *		if the spare is gone or its exec failed.	*/
+pid_t prefork_launch(struct cmdslot *slot, char **argv, int inFd, int outFd, int errFd) {
+	// the spare gets the length of argv's strings with the descriptors, then the strings
+	size_t len = 0;
+	int i;
+	for (i = 0; argv[i] != NULL; ++i) len += strlen(argv[i]) + 1;
+	int status[2];
+	if (pipe2(status, O_CLOEXEC) != 0) return -1;
+	int fds[4] = { inFd >= 0 ? inFd : STDIN_FILENO, outFd >= 0 ? outFd : STDOUT_FILENO,
+		errFd >= 0 ? errFd : STDERR_FILENO, status[1] };
+	union {
+		char buffer[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { &len, sizeof(len) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buffer;
+	msg.msg_controllen = sizeof(control.buffer);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	int ok = sendmsg(slot->spareFd, &msg, MSG_NOSIGNAL) == sizeof(len);
+	close(status[1]);
+	for (i = 0; ok && argv[i] != NULL; ++i) {
+		size_t done = 0, size = strlen(argv[i]) + 1;
+		while (ok && done < size) {
+			ssize_t sent = send(slot->spareFd, argv[i] + done, size - done, MSG_NOSIGNAL);
+			if (sent < 0 && errno == EINTR) continue;
+			ok = sent > 0;
+			done += sent;
+		}
+	}
+
+	// nothing comes through the pipe if the exec worked, and EOF if the spare died
+	int err = 0;
+	ssize_t got = 0;
+	if (ok) {
+		while ((got = read(status[0], &err, sizeof(err))) < 0 && errno == EINTR) ;
+	}
+	close(status[0]);
+
+	// either way the spare is used up: it runs argv now, or it died
+	pid_t pid = slot->spare;
+	close(slot->spareFd);
+	slot->spare = 0;
+	--numSpares;
+	if (ok && got == 0) return pid;
+	if (got != sizeof(err)) kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	return -1;
+}
+
+
+/* Function Name: prefork_want
+ * Asks for slot's command to get a spare the next time prefork_refill runs, if
+ *		it has none and there is room for another.	*/
+void prefork_want(struct cmdslot *slot) {
+	int i;
+	if (slot->spare > 0 || numSpares + numWanted >= PREFORK_MAX) return;
+	for (i = 0; i < numWanted; ++i) {
+		if (preforkWanted[i] == slot->name) return;
+	}
+	preforkWanted[numWanted++] = slot->name;
+}
+
+
+/* Function Name: prefork_refill
+ * Forks the spares that prefork_want asked for.  It is run between launches, so
+ *		the fork isn't part of any launch's time; the summary counts it apart.	*/
+void prefork_refill(void) {
+	struct timespec before, after;
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	while (numWanted > 0) {
+		struct cmdslot *slot = command_slot(preforkWanted[--numWanted]);
+		if (slot->spare > 0 || slot->path == NULL) continue;
+
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) break;
+		// anything still buffered would be printed again by the spare
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid < 0) {
+			close(sv[0]);
+			close(sv[1]);
+			break;
+		}
+		if (pid == 0) spare_main(sv[1], slot->path);
+		close(sv[1]);
+		slot->spare = pid;
+		slot->spareFd = sv[0];
+		++numSpares;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &after);
+	spareNanos += (after.tv_sec - before.tv_sec) * 1000000000LL + after.tv_nsec - before.tv_nsec;
+}
+
+
+/* Function Name: spare_main
+ * Preconditions: this is a spare, fd its end of the socket to the shell
+ * Opens the program at path, so the path lookup and the program's first pages
+ *		are done ahead of time, then waits for prefork_launch.  Once it has
+ *		argv and the descriptors, it makes them its stdin, stdout and stderr
+ *		and execs the program.  If that fails, the errno goes back to the
+ *		shell through the status pipe sent last.  Never returns.	*/
+void spare_main(int fd, const char *path) {
+	// nothing of the shell's is needed: the other spares' sockets would keep them waiting
+	if (fd != 3 && (dup2(fd, 3) != 3 || fcntl(3, F_SETFD, FD_CLOEXEC) != 0)) _exit(127);
+	syscall(SYS_close_range, 4, ~0U, 0);
+	fd = 3;
+	int exe = open(path, O_RDONLY | O_CLOEXEC);
+	if (exe >= 0) readahead(exe, 0, 1 << 20);
+
+	// the length of argv's strings comes with the descriptors; EOF means the shell is done with us
+	size_t len;
+	int fds[4];
+	union {
+		char buffer[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { &len, sizeof(len) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buffer;
+	msg.msg_controllen = sizeof(control.buffer);
+	ssize_t got;
+	while ((got = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) ;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (got != sizeof(len) || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS) _exit(0);
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+	char *strings = malloc(len);
+	size_t done = 0;
+	while (strings != NULL && done < len) {
+		if ((got = read(fd, strings + done, len - done)) <= 0) {
+			if (got < 0 && errno == EINTR) continue;
+			_exit(0);
+		}
+		done += got;
+	}
+	int numArgs = 0;
+	for (done = 0; done < len; done += strlen(strings + done) + 1) ++numArgs;
+	char **argv = malloc((numArgs + 1) * sizeof(char *));
+	int err = ENOMEM;
+	if (strings == NULL || argv == NULL) {
+		write(fds[3], &err, sizeof(err));
+		_exit(127);
+	}
+	numArgs = 0;
+	for (done = 0; done < len; done += strlen(strings + done) + 1) argv[numArgs++] = strings + done;
+	argv[numArgs] = NULL;
+
+	// the redirections, after the fork
+	int i;
+	for (i = 0; i < 3; ++i) {
+		if (dup2(fds[i], i) != i) {
+			err = errno;
+			write(fds[3], &err, sizeof(err));
+			_exit(127);
+		}
+	}
+	sigset_t noSignals;
+	sigemptyset(&noSignals);
+	sigprocmask(SIG_SETMASK, &noSignals, NULL);
+
+	// a script can't be run from its descriptor once that is closed on exec, so then it's the path
+	if (exe >= 0) fexecve(exe, argv, environ);
+	execv(path, argv);
+	err = errno;
+	write(fds[3], &err, sizeof(err));
+	_exit(127);
+}
+
+
+/* Function Name: prefork_discard
+ * Ends slot's spare, if it has one.	*/
+void prefork_discard(struct cmdslot *slot) {
+	if (slot->spare <= 0) return;
+	close(slot->spareFd);
+	waitpid(slot->spare, NULL, 0);
+	slot->spare = 0;
+	--numSpares;
 }
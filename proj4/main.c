@@ -8,13 +8,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "page_table.h"
 #include "disk.h"
 #include "program.h"
+#include "zpool.h"
 
 #define MAX_LRU 0 
 
+// fillValue[page] for a page whose contents are not a single repeated byte
+#define NOT_FILLED -1
+
+// the working set is the pages referenced in this many of the most recent windows
+#define WS_WINDOWS 2
+#define WS_DEFAULT_WINDOW 50
+
 //////////////////////
 // GLOBAL VARIABLES //
 //////////////////////
@@ -26,6 +35,32 @@ int diskReads = 0;
 int diskWrites = 0;
 int *lruData = NULL;
 int lruUpdate = 0;
+struct zpool *zpool = NULL;
+int nframes = 0;		// frames available for pages (the zero frame is not one of them)
+int *fillValue = NULL;		// per page: the byte the whole page is filled with, or NOT_FILLED
+int zeroFrame = -1;		// shared read-only frame of zeros, -1 if not in use
+int readsSaved = 0;
+int writesSaved = 0;
+int fillStores = 0;
+int zeroMaps = 0;
+int *wasDirty = NULL;		// per page: 1 if the page was written during its last time in memory
+int *eager = NULL;		// per frame: 1 if the page was mapped writable before it was written
+unsigned long *eagerHash = NULL;	// per frame: hash of an eager page's contents when it was loaded
+int upgradeFaults = 0;
+int upgradesAvoided = 0;
+int wrongDirty = 0;
+int maxFrames = 0;		// budget for the adaptive frame pool, 0 if the pool is fixed
+int framesPeak = 0;
+int wsWindow = 0;		// faults per working set window, 0 if the estimator is off
+int wsTicks = 0;
+int wsCurrent = 0;		// number of the current window
+int *lastRef = NULL;		// per page: the last window in which the page was referenced
+int *sampled = NULL;		// per page: 1 if its access was taken away to sample the reference bit
+int *savedBits = NULL;		// per page: the real bits of a sampled page
+int refSamples = 0;
+int wsPeak = 0;
+long wsTotal = 0;
+int wsSamples = 0;
 
 /////////////////////////
 // FUNCTION PROTOTYPES //
@@ -34,6 +69,15 @@ void page_fault_handler(struct page_table *pt, int page);
 int pf_RANDOM(struct page_table *pt);
 int pf_FIFO(struct page_table *pt);
 int pf_CUSTOM(struct page_table *pt);
+void load_page(int page, char *frameStart);
+void store_page(int page, const char *frameStart);
+int page_fill_value(const char *frameStart);
+void page_dirtied(int page);
+unsigned long page_hash(const char *frameStart);
+void eager_check(int page, int frame, const char *frameStart);
+void evict_frame(struct page_table *pt, int frame);
+int page_bits(struct page_table *pt, int page);
+void ws_end_window(struct page_table *pt);
 
 
 ////////////
@@ -41,26 +85,78 @@ int pf_CUSTOM(struct page_table *pt);
 ////////////
 int main( int argc, char *argv[] )
 {
+	// get the options
+	int poolPages = 0;
+	int dedup = 0;
+	int predict = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "z:dZwW:A:")) != -1) {
+		switch (opt) {
+			case 'z':	// size of the compressed pool, in pages worth of bytes
+				poolPages = atoi(optarg);
+				if (poolPages <= 0) {
+					printf("pool size must be larger than 0.\n");
+					return 1;
+				}
+				break;
+			case 'd':	// keep zero and same-fill pages as metadata only
+				if (!dedup) dedup = 1;
+				break;
+			case 'Z':	// ... and map never-written pages to a shared zero frame
+				dedup = 2;
+				break;
+			case 'w':	// map pages that were written last time read-write right away
+				predict = 1;
+				break;
+			case 'W':	// estimate the working set every so many faults
+				wsWindow = atoi(optarg);
+				if (wsWindow <= 0) {
+					printf("window size must be larger than 0.\n");
+					return 1;
+				}
+				break;
+			case 'A':	// size the frame pool from the working set, up to this many frames
+				maxFrames = atoi(optarg);
+				if (maxFrames <= 0) {
+					printf("frame budget must be larger than 0.\n");
+					return 1;
+				}
+				break;
+			default:
+				argc = 0;	// forces the usage message below
+				break;
+		}
+	}
+
 	// check arg count
-	if(argc!=5) {
-		printf("usage: virtmem <npages> <nframes> <rand|fifo|custom> <sort|scan|focus>\n");
+	if(argc-optind!=4) {
+		printf("usage: virtmem [-z <poolpages>] [-d|-Z] [-w] [-W <window>] [-A <maxframes>] <npages> <nframes> <rand|fifo|custom> <sort|scan|focus|extsort|radix>\n");
 		return 1;
 	}
 
 	// get the arguments
-	int npages = atoi(argv[1]);
-	int nframes = atoi(argv[2]);
+	int npages = atoi(argv[optind]);
+	nframes = atoi(argv[optind+1]);
 	if (npages <= 0 || nframes <= 0) {
 		printf("npages and nframes must be larger than 0.\n");
 		return 1;
 	}
 
-	alg = argv[3];
+	// the adaptive pool needs the estimator, and starts out at nframes
+	if (maxFrames > 0) {
+		if (wsWindow == 0) wsWindow = WS_DEFAULT_WINDOW;
+		if (nframes > maxFrames) nframes = maxFrames;
+		framesPeak = nframes;
+	}
+	// every array indexed by frame has to be big enough for the largest the pool can get
+	int tableFrames = maxFrames > 0 ? maxFrames : nframes;
+
+	alg = argv[optind+2];
 	if (!strcmp(alg, "rand") && !strcmp(alg, "fifo") && !strcmp(alg, "custom")) {
 		printf("unknown page replacement algorithm: %s\n", alg);
 		return 1;
 	}
-	const char *program = argv[4];
+	const char *program = argv[optind+3];
 
 	// create the virtual disk
 	disk = disk_open("myvirtualdisk", npages);
@@ -70,7 +166,9 @@ int main( int argc, char *argv[] )
 	}
 
 	// create the page table
-	struct page_table *pt = page_table_create(npages, nframes, page_fault_handler);
+	// the shared zero frame is one extra frame past the ones used for pages
+	if (dedup == 2) zeroFrame = tableFrames;
+	struct page_table *pt = page_table_create(npages, dedup == 2 ? tableFrames + 1 : tableFrames, page_fault_handler);
 	if(!pt) {
 		fprintf(stderr,"couldn't create page table: %s\n",strerror(errno));
 		return 1;
@@ -79,21 +177,64 @@ int main( int argc, char *argv[] )
 	// create the reverse page table - indexed by frame number so don't have to search
 	// 	page table for what page goes with a particular frame, also keeps track
 	// 	of free frames (= -1) in this case
-	reverse_pt = malloc(page_table_get_nframes(pt) * sizeof(int));
+	reverse_pt = malloc(tableFrames * sizeof(int));
 	if (!reverse_pt) {
 		fprintf(stderr, "couldn't create reverse page table: %s\n", strerror(errno));
 		return 1;
 	}
 	int i; 
-	for (i = 0; i < page_table_get_nframes(pt); ++i) reverse_pt[i] = -1;
+	for (i = 0; i < nframes; ++i) reverse_pt[i] = -1;
 
 	// initialize the LRU bits to 0
-	lruData = malloc(page_table_get_nframes(pt) * sizeof(int));
+	lruData = malloc(tableFrames * sizeof(int));
 	if (!lruData) {
 		fprintf(stderr, "couldn't create lru data: %s\n", strerror(errno));
 		return 1;
 	}
-	for (i = 0; i < page_table_get_nframes(pt); ++i) lruData[i] = 0;
+	for (i = 0; i < nframes; ++i) lruData[i] = 0;
+
+	// create the compressed pool that evicted pages go to before the disk
+	if (poolPages > 0) {
+		zpool = zpool_create(npages, poolPages*PAGE_SIZE);
+		if (!zpool) {
+			fprintf(stderr, "couldn't create compressed pool: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+
+	// a fresh virtual disk is all zeros, so every page starts out as a zero-filled page
+	if (dedup) {
+		fillValue = malloc(npages * sizeof(int));
+		if (!fillValue) {
+			fprintf(stderr, "couldn't create fill data: %s\n", strerror(errno));
+			return 1;
+		}
+		for (i = 0; i < npages; ++i) fillValue[i] = 0;
+	}
+	// the write predictor starts out assuming nothing will be written
+	if (predict) {
+		wasDirty = calloc(npages, sizeof(int));
+		eager = calloc(tableFrames, sizeof(int));
+		eagerHash = calloc(tableFrames, sizeof(unsigned long));
+		if (!wasDirty || !eager || !eagerHash) {
+			fprintf(stderr, "couldn't create write predictor data: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+
+	// the working set estimator samples reference bits by taking away access to resident pages
+	if (wsWindow > 0) {
+		lastRef = malloc(npages * sizeof(int));
+		sampled = calloc(npages, sizeof(int));
+		savedBits = calloc(npages, sizeof(int));
+		if (!lastRef || !sampled || !savedBits) {
+			fprintf(stderr, "couldn't create working set data: %s\n", strerror(errno));
+			return 1;
+		}
+		for (i = 0; i < npages; ++i) lastRef[i] = -WS_WINDOWS;
+	}
+
+	if (zeroFrame != -1) memset(page_table_get_physmem(pt) + zeroFrame*PAGE_SIZE, 0, PAGE_SIZE);
 
 	char *virtmem = page_table_get_virtmem(pt);
 
@@ -101,15 +242,43 @@ int main( int argc, char *argv[] )
 	if(!strcmp(program,"sort")) sort_program(virtmem, npages*PAGE_SIZE);
 	else if(!strcmp(program,"scan")) scan_program(virtmem, npages*PAGE_SIZE);
 	else if(!strcmp(program,"focus")) focus_program(virtmem, npages*PAGE_SIZE);
-	else fprintf(stderr, "unknown program: %s\n", argv[3]);
+	else if(!strcmp(program,"extsort")) extsort_program(virtmem, npages*PAGE_SIZE);
+	else if(!strcmp(program,"radix")) radix_program(virtmem, npages*PAGE_SIZE);
+	else fprintf(stderr, "unknown program: %s\n", program);
 
 	printf("page faults: %d\ndisk reads: %d\ndisk writes: %d\n", pageFaults, diskReads, diskWrites);
+	if (zpool) zpool_print_stats(zpool);
+	if (fillValue) {
+		printf("fill pages stored: %d\ndisk reads saved: %d\ndisk writes saved: %d\n", fillStores, readsSaved, writesSaved);
+		if (zeroFrame != -1) printf("zero frame maps: %d\n", zeroMaps);
+	}
+	if (wasDirty) {
+		// eager pages still in memory at the end count too
+		for (i = 0; i < nframes; ++i) {
+			if (reverse_pt[i] != -1 && eager[i]) eager_check(reverse_pt[i], i, page_table_get_physmem(pt) + i*PAGE_SIZE);
+		}
+		printf("write upgrade faults: %d\nwrite upgrades avoided: %d\nclean pages written back: %d\n", upgradeFaults, upgradesAvoided, wrongDirty);
+	}
+	if (wsWindow > 0) {
+		// the largest working set seen is the smallest pool that would have held every window
+		printf("reference samples: %d\nworking set: avg %.1f peak %d\nsuggested nframes: %d\n",
+			refSamples, wsSamples ? (double)wsTotal / wsSamples : 0.0, wsPeak, wsPeak);
+		if (maxFrames > 0) printf("frames: final %d peak %d budget %d\n", nframes, framesPeak, maxFrames);
+	}
 
 	// clean up
 	page_table_delete(pt);
 	disk_close(disk);
 	free(reverse_pt);
 	free(lruData);
+	if (zpool) zpool_delete(zpool);
+	free(fillValue);
+	free(wasDirty);
+	free(eager);
+	free(eagerHash);
+	free(lastRef);
+	free(sampled);
+	free(savedBits);
 
 	return 0;
 }
@@ -118,17 +287,46 @@ int main( int argc, char *argv[] )
 // page_fault_handler() //
 //////////////////////////
 void page_fault_handler(struct page_table *pt, int page) {
-	/** (1) check if page fault happened because page is being written to for the first time **/
+	// every fault is a tick of virtual time for the working set estimator
+	if (wsWindow > 0 && ++wsTicks % wsWindow == 0) ws_end_window(pt);
+	if (lastRef) lastRef[page] = wsCurrent;
+
+	/** (0) check if page fault happened because the page's reference bit was sampled **/
 	int frame, bits;
 	page_table_get_entry(pt, page, &frame, &bits);
 
+	if (sampled && sampled[page]) {
+		// the page never left memory, so just give back its permissions
+		sampled[page] = 0;
+		page_table_set_entry(pt, page, frame, savedBits[page]);
+		++refSamples;
+		lruData[frame] = MAX_LRU;
+		return;
+	}
+
+	/** (1) check if page fault happened because page is being written to for the first time **/
+
+	// the bits the page gets once it has a frame, normally read only until the first write
+	int newBits = PROT_READ;
+
+	// a write to a page mapped to the shared zero frame needs a real frame of its own,
+	// 	but like any write upgrade it isn't a new page fault
+	int zeroUpgrade = (bits & PROT_READ) && frame == zeroFrame;
+	if (zeroUpgrade) {
+		newBits = PROT_READ | PROT_WRITE;
+		++upgradeFaults;
+	}
 	// if the read bit is set, then it is already in memory and the write bit just has to added
-	if (bits & PROT_READ) {	// will be non-zero if the read bit is set
+	else if (bits & PROT_READ) {	// will be non-zero if the read bit is set
 		// or the original bits with PROT_WRITE to add that permission
 		bits = bits | PROT_WRITE;
 		// use the original page/frame mapping so only the bits change
 		page_table_set_entry(pt, page, frame, bits);
 
+		// the saved copy of the page is about to be out of date
+		page_dirtied(page);
+		++upgradeFaults;
+
 		// update the lru data for that page
 		lruData[frame] = MAX_LRU;
 
@@ -136,86 +334,257 @@ void page_fault_handler(struct page_table *pt, int page) {
 	}
 
 	// page faults should only be counted if they aren't because of adding a write bit
-	++pageFaults;
-
-	// increment lru update counter
-	++lruUpdate;
-	if (lruUpdate % 5 == 0) { 
-		int i;
-		for (i = 0; i < page_table_get_nframes(pt); ++i) {
-			--lruData[i];
+	if (!zeroUpgrade) {
+		++pageFaults;
+
+		// increment lru update counter
+		++lruUpdate;
+		if (lruUpdate % 5 == 0) { 
+			int i;
+			for (i = 0; i < nframes; ++i) {
+				--lruData[i];
+			}
 		}
 	}
 
+	// a page that was written last time it was in memory will probably be written again,
+	// 	so save the second fault by mapping it writable from the start
+	if (wasDirty && wasDirty[page]) newBits = PROT_READ | PROT_WRITE;
+
+	// a page nobody has written to yet can share the zero frame until it is written
+	if (zeroFrame != -1 && newBits == PROT_READ && fillValue[page] == 0) {
+		page_table_set_entry(pt, page, zeroFrame, PROT_READ);
+		++zeroMaps;
+		return;
+	}
+
 	/** (2) check if there is a free frame to which the page could be mapped **/
-	for (frame = 0; frame < page_table_get_nframes(pt); ++frame) {
+	for (frame = 0; frame < nframes; ++frame) {
 		if (reverse_pt[frame] == -1) break;
 	}
 
-	if (frame < page_table_get_nframes(pt)) {
-		// pull it into memory at location frame -- disk read into memory
-		// the block location corresponds to the start of the page location in virtual mem
-		char *frameStart = page_table_get_physmem(pt) + frame*PAGE_SIZE;
-		disk_read(disk, page, frameStart);
-		++diskReads;
-
-		// create the pt entry with the new page-frame mapping and PROT_READ bit set
-		page_table_set_entry(pt, page, frame, PROT_READ);
-		
-		// update the lru data for that page
-		lruData[frame] = MAX_LRU;
-
-		// change reverse_pt[frame] to reflect that it now has page's data in it
-		reverse_pt[frame] = page;
+	/** (3) if there are no free frames, then call the specified algorithm for page replacement **/
+	if (frame == nframes) {
+		if (!strcmp(alg, "rand")) frame = pf_RANDOM(pt);		
+		else if (!strcmp(alg, "fifo")) frame = pf_FIFO(pt);
+		else if (!strcmp(alg, "custom")) frame = pf_CUSTOM(pt);
+		else {
+			// this case should never happen because a check is done earlier
+			printf("algorithm type not recognized: %s\n", alg);
+			exit(1);
+		}
 
-		return;	
+		// write back the victim if needed and take its frame
+		evict_frame(pt, frame);
 	}
 
-
-	/** (3) if there are no free frames, then call the specified algorithm for page replacement **/
-	if (!strcmp(alg, "rand")) frame = pf_RANDOM(pt);		
-	else if (!strcmp(alg, "fifo")) frame = pf_FIFO(pt);
-	else if (!strcmp(alg, "custom")) frame = pf_CUSTOM(pt);
-	else {
-		// this case should never happen because a check is done earlier
-		printf("algorithm type not recognized: %s\n", alg);
-		exit(1);
+	// pull it into memory at location frame -- disk read into memory
+	// the block location corresponds to the start of the page location in virtual mem
+	char *frameStart = page_table_get_physmem(pt) + frame*PAGE_SIZE;
+	load_page(page, frameStart);
+
+	// create the pt entry with the new page-frame mapping
+	page_table_set_entry(pt, page, frame, newBits);
+	if (newBits & PROT_WRITE) page_dirtied(page);
+	if (eager) {
+		eager[frame] = wasDirty[page];
+		if (eager[frame]) eagerHash[frame] = page_hash(frameStart);
 	}
+
+	// update the lru data for that page
+	lruData[frame] = MAX_LRU;	
 	
+	// change reverse_pt[frame] to reflect that it now has page's data in it
+	reverse_pt[frame] = page;
+
+}
+
+
+///////////////////
+// evict_frame() //
+///////////////////
+void evict_frame(struct page_table *pt, int frame) {
 	// find what was chosen as victim
 	int victPage = reverse_pt[frame];
-	int victBits;
-	page_table_get_entry(pt, victPage, &frame, &victBits);
+	int victBits = page_bits(pt, victPage);
+	char *frameStart = page_table_get_physmem(pt) + frame*PAGE_SIZE;
+
+	// see whether the predictor was right about the victim, and remember if it was written
+	if (wasDirty) {
+		wasDirty[victPage] = (victBits & PROT_WRITE) != 0;
+		if (eager[frame]) eager_check(victPage, frame, frameStart);
+	}
 
 	// check if the victim page is dirty and has to be written back
-	if (victBits & PROT_WRITE) {
-		char *frameStart = page_table_get_physmem(pt) + frame*PAGE_SIZE;
-		disk_write(disk, victPage, frameStart);
-		++diskWrites;
+	if (victBits & PROT_WRITE) store_page(victPage, frameStart);
+
+	// update the page table and the reverse page table
+	page_table_set_entry(pt, victPage, frame, 0);
+	if (sampled) sampled[victPage] = 0;
+	reverse_pt[frame] = -1;
+}
+
+
+/////////////////
+// page_bits() //
+/////////////////
+int page_bits(struct page_table *pt, int page) {
+	// a page whose reference bit is being sampled keeps its real bits in savedBits
+	int frame, bits;
+	page_table_get_entry(pt, page, &frame, &bits);
+	if (sampled && sampled[page]) return savedBits[page];
+	return bits;
+}
+
+
+/////////////////////
+// ws_end_window() //
+/////////////////////
+void ws_end_window(struct page_table *pt) {
+	// the working set is every page referenced in the last WS_WINDOWS windows
+	int wss = 0;
+	int i;
+	for (i = 0; i < page_table_get_npages(pt); ++i) {
+		if (lastRef[i] > wsCurrent - WS_WINDOWS) ++wss;
 	}
+	++wsCurrent;
+
+	wsTotal += wss;
+	++wsSamples;
+	if (wss > wsPeak) wsPeak = wss;
+	printf("window %d: working set %d pages, %d frames, %d faults\n", wsCurrent, wss, nframes, pageFaults);
+
+	// resize the frame pool to fit the working set with some room to spare
+	if (maxFrames > 0) {
+		int target = wss + wss/4 + 1;
+		if (target > maxFrames) target = maxFrames;
+
+		// shrinking gives up the highest frames, so their pages are evicted first
+		for (i = target; i < nframes; ++i) {
+			if (reverse_pt[i] != -1) evict_frame(pt, i);
+		}
+		// growing just adds free frames at the top
+		for (i = nframes; i < target; ++i) {
+			reverse_pt[i] = -1;
+			lruData[i] = 0;
+			if (eager) eager[i] = 0;
+		}
+		nframes = target;
+		if (nframes > framesPeak) framesPeak = nframes;
+	}
+
+	// clear the reference bits by taking away access, so the next use of a page is noticed
+	for (i = 0; i < nframes; ++i) {
+		int page = reverse_pt[i];
+		if (page == -1 || sampled[page]) continue;
+
+		savedBits[page] = page_bits(pt, page);
+		sampled[page] = 1;
+		page_table_set_entry(pt, page, i, 0);
+	}
+}
+
+
+/////////////////
+// load_page() //
+/////////////////
+void load_page(int page, char *frameStart) {
+	// a page that is a single repeated byte is rebuilt from its metadata
+	if (fillValue && fillValue[page] != NOT_FILLED) {
+		memset(frameStart, fillValue[page], PAGE_SIZE);
+		++readsSaved;
+		return;
+	}
+
+	// a page in the compressed pool doesn't have to be read from disk
+	if (zpool && zpool_load(zpool, page, frameStart)) return;
 
-	// then, read from disk whatever page we need
-	char *frameStart = page_table_get_physmem(pt) + frame*PAGE_SIZE;
 	disk_read(disk, page, frameStart);
 	++diskReads;
+}
 
-	// update the page table
-	page_table_set_entry(pt, victPage, frame, 0);
-	page_table_set_entry(pt, page, frame, PROT_READ);
 
-	// update the lru data for that page
-	lruData[frame] = MAX_LRU;	
-	
-	// update the reverse page table
-	reverse_pt[frame] = page;
+//////////////////
+// store_page() //
+//////////////////
+void store_page(int page, const char *frameStart) {
+	// a page that is a single repeated byte is kept as metadata only
+	if (fillValue) {
+		fillValue[page] = page_fill_value(frameStart);
+		if (fillValue[page] != NOT_FILLED) {
+			++fillStores;
+			++writesSaved;
+			return;
+		}
+	}
+
+	// only pages that don't compress well (or don't fit in the pool) go to disk
+	if (zpool && zpool_store(zpool, page, frameStart)) return;
+
+	disk_write(disk, page, frameStart);
+	++diskWrites;
+}
+
+
+///////////////////////
+// page_fill_value() //
+///////////////////////
+int page_fill_value(const char *frameStart) {
+	// compare a word at a time against the first byte repeated across a word
+	const unsigned long *words = (const unsigned long *)frameStart;
+	unsigned long pattern = (unsigned char)frameStart[0] * (~0UL / 0xff);
+	int i;
+	for (i = 0; i < PAGE_SIZE / sizeof(unsigned long); ++i) {
+		if (words[i] != pattern) return NOT_FILLED;
+	}
+	return (unsigned char)frameStart[0];
+}
 
+
+////////////////////
+// page_dirtied() //
+////////////////////
+void page_dirtied(int page) {
+	// once a page is writable, neither the compressed copy nor the fill value can be trusted
+	if (zpool) zpool_invalidate(zpool, page);
+	if (fillValue) fillValue[page] = NOT_FILLED;
 }
 
+
+/////////////////
+// page_hash() //
+/////////////////
+unsigned long page_hash(const char *frameStart) {
+	// FNV-1a over the page, only used to tell whether an eager page was really written
+	unsigned long hash = 14695981039346656037UL;
+	int i;
+	for (i = 0; i < PAGE_SIZE; ++i) {
+		hash ^= (unsigned char)frameStart[i];
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+
+///////////////////
+// eager_check() //
+///////////////////
+void eager_check(int page, int frame, const char *frameStart) {
+	// an eager page that changed saved an upgrade fault, one that didn't gets written back for nothing
+	if (page_hash(frameStart) != eagerHash[frame]) ++upgradesAvoided;
+	else {
+		++wrongDirty;
+		wasDirty[page] = 0;
+	}
+	eager[frame] = 0;
+}
+
+
 /////////////////
 // pf_RANDOM() //
 /////////////////
 int pf_RANDOM(struct page_table *pt) {
-	int victim = lrand48() % page_table_get_nframes(pt);	
+	int victim = lrand48() % nframes;	
 	return victim;
 }
 
@@ -229,11 +598,13 @@ int pf_FIFO(struct page_table *pt) {
 	// when the pages are initially filled in, it is in order (ie. first page in is mapped 
 	// 	to frame 0, second page to frame 1, ...)
 	// so simply increasing the index from 0 will be FIFO behavior
+	// the adaptive pool may have shrunk below the index since the last call
+	if (index >= nframes) index = 0;
 
 	int victim = index;
 
 	// update the index for the next one
-	index = (index + 1) % page_table_get_nframes(pt);
+	index = (index + 1) % nframes;
 	return victim;
 }
 
@@ -249,10 +620,10 @@ int pf_CUSTOM(struct page_table *pt) {
 	int minNoWrite = MAX_LRU + 1;
 	int victimW = -1;
 	int victimNW = -1;
-	int frame, bits;
+	int bits;
 	int i;
-	for (i = 0; i < page_table_get_nframes(pt); ++i) {
-		page_table_get_entry(pt, reverse_pt[i], &frame, &bits);
+	for (i = 0; i < nframes; ++i) {
+		bits = page_bits(pt, reverse_pt[i]);
 
 		if (!(bits & PROT_WRITE)) {
 			if (lruData[i] < minNoWrite) {
@@ -268,7 +639,7 @@ int pf_CUSTOM(struct page_table *pt) {
 	} 
 
 	int diff = minNoWrite - minWrite;
-	int thresh = page_table_get_nframes(pt)/2;
+	int thresh = nframes/2;
 
 	if (victimNW == -1) return victimW;
 	if (victimW == -1) return victimNW; 
@@ -3,6 +3,10 @@
 
 #include "program.h"
 
+// extsort sorts runs of one page each, then merges at most this many runs at a time
+#define RUN_SIZE 4096
+#define MERGE_FANIN 4
+
 /* compare_bytes()
  * Used as the comparison function for quiksort
  */
@@ -16,6 +20,109 @@ static int compare_bytes(const void *pa, const void *pb)
 	else return 1;
 }
 
+/* merge_runs()
+ * Merge the sorted runs of "runLen" bytes in src[0..length) into dst, "nruns" at a time.
+ * Only the head page of each run and the output page have to be in memory at once.
+ */
+static void merge_runs(const char *src, char *dst, int length, int runLen, int nruns)
+{
+	int group;
+	for (group = 0; group < length; group += runLen * nruns) {
+		int pos[MERGE_FANIN], end[MERGE_FANIN];
+		int k, n = 0;
+		for (k = 0; k < nruns && group + k*runLen < length; k++) {
+			pos[k] = group + k*runLen;
+			end[k] = pos[k] + runLen < length ? pos[k] + runLen : length;
+			n++;
+		}
+
+		// take the smallest head of the runs until they are all used up
+		int out = group;
+		while (1) {
+			int best = -1;
+			for (k = 0; k < n; k++) {
+				if (pos[k] < end[k] && (best == -1 || src[pos[k]] < src[pos[best]])) best = k;
+			}
+			if (best == -1) break;
+			dst[out++] = src[pos[best]++];
+		}
+	}
+}
+
+/* extsort_program()
+ * Sorts like sort_program, but the way an external sort would: each page-sized run
+ * 	is sorted on its own, then the runs are merged MERGE_FANIN at a time.
+ * The merge needs somewhere to put its output, so the first half of the memory is
+ * 	sorted and the second half is used to ping-pong the merge passes.
+ */
+void extsort_program(char *data, int length)
+{
+	int total = 0;
+	int i;
+	int half = length / 2;
+	char *src = data;
+	char *dst = data + half;
+
+	srand(4856);
+
+	for (i = 0; i < half; i++) {
+		src[i] = rand();
+	}
+
+	for (i = 0; i < half; i += RUN_SIZE) {
+		qsort(src + i, i + RUN_SIZE < half ? RUN_SIZE : half - i, 1, compare_bytes);
+	}
+
+	int runLen;
+	for (runLen = RUN_SIZE; runLen < half; runLen *= MERGE_FANIN) {
+		merge_runs(src, dst, half, runLen, MERGE_FANIN);
+		char *tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	for (i = 0; i < half; i++) {
+		total += src[i];
+	}
+
+	printf("extsort result is %d\n", total);
+}
+
+/* radix_program()
+ * Sorts the same data as sort_program with a counting sort: one pass to count
+ * 	each byte value and one pass to write them back in order.
+ */
+void radix_program(char *data, int length)
+{
+	int total = 0;
+	int count[256] = {0};
+	int i, v;
+
+	srand(4856);
+
+	for (i = 0; i < length; i++) {
+		data[i] = rand();
+	}
+
+	// index by value + 128 so the buckets are in the same order compare_bytes uses
+	for (i = 0; i < length; i++) {
+		count[(signed char)data[i] + 128]++;
+	}
+
+	i = 0;
+	for (v = 0; v < 256; v++) {
+		while (count[v]-- > 0) {
+			data[i++] = v - 128;
+		}
+	}
+
+	for (i = 0; i < length; i++) {
+		total += data[i];
+	}
+
+	printf("radix result is %d\n", total);
+}
+
 /* focus_program() */
 void focus_program(char *data, int length)
 {
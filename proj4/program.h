@@ -4,5 +4,7 @@
 void scan_program( char *data, int length );
 void sort_program( char *data, int length );
 void focus_program( char *data, int length );
+void extsort_program( char *data, int length );
+void radix_program( char *data, int length );
 
 #endif
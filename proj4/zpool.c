@@ -0,0 +1,218 @@
+/* Sam Rack
+ * CSE 30341 - Operating Systems
+ * Project 4 - Virtual Memory
+ * zpool.c
+ * A bounded pool of compressed pages that sits between the frames and the disk.
+ * Evicted pages that compress well are kept here instead of being written to disk,
+ * 	and a later fault on the page is satisfied from the pool instead of a disk read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "page_table.h"
+#include "zpool.h"
+
+// compressed pages larger than this are not worth keeping in the pool
+#define ZPOOL_MAX_LEN (PAGE_SIZE*3/4)
+
+// run lengths for the codec: a control byte below 128 means (c+1) literal bytes follow,
+// 	a control byte of 128 or more means the next byte is repeated (c-125) times
+#define MAX_LITERAL 128
+#define MIN_REPEAT 3
+#define MAX_REPEAT 130
+
+struct zentry {
+	char *data;	// compressed bytes, NULL if the page is not in the pool
+	int len;
+};
+
+struct zpool {
+	struct zentry *entries;	// indexed by page number
+	int npages;
+	int maxbytes;
+	int usedbytes;
+	char *scratch;		// compression output before it is copied into the pool
+	int stores;
+	int loads;
+	int rejectsFull;
+	int rejectsBig;
+};
+
+
+/* zpool_compress()
+ * Run-length encode one page of "src" into "dst", writing at most "limit" bytes.
+ * Returns the compressed length, or -1 if the page does not fit in "limit" bytes.
+ */
+static int zpool_compress( const unsigned char *src, unsigned char *dst, int limit )
+{
+	int in = 0, out = 0;
+
+	while (in < PAGE_SIZE) {
+		// measure the run of identical bytes starting here
+		int run = 1;
+		while (in + run < PAGE_SIZE && run < MAX_REPEAT && src[in + run] == src[in]) ++run;
+
+		if (run >= MIN_REPEAT) {
+			if (out + 2 > limit) return -1;
+			dst[out++] = (unsigned char)(run + 125);
+			dst[out++] = src[in];
+			in += run;
+			continue;
+		}
+
+		// otherwise gather literals until the next run worth encoding
+		int start = in;
+		int count = 0;
+		while (in < PAGE_SIZE && count < MAX_LITERAL) {
+			if (in + 2 < PAGE_SIZE && src[in] == src[in + 1] && src[in] == src[in + 2]) break;
+			++in;
+			++count;
+		}
+
+		if (out + 1 + count > limit) return -1;
+		dst[out++] = (unsigned char)(count - 1);
+		memcpy(dst + out, src + start, count);
+		out += count;
+	}
+
+	return out;
+}
+
+/* zpool_decompress()
+ * Expand "len" bytes of run-length encoded data in "src" into one page at "dst".
+ */
+static void zpool_decompress( const unsigned char *src, int len, unsigned char *dst )
+{
+	int in = 0, out = 0;
+
+	while (in < len) {
+		int c = src[in++];
+		if (c < MAX_LITERAL) {
+			memcpy(dst + out, src + in, c + 1);
+			in += c + 1;
+			out += c + 1;
+		} else {
+			memset(dst + out, src[in++], c - 125);
+			out += c - 125;
+		}
+	}
+}
+
+
+/* zpool_create()
+ * Create a compressed pool for a virtual memory of "npages" pages that will hold
+ * 	at most "maxbytes" bytes of compressed data.
+ * Returns a pointer to the new pool, or null on failure.
+ */
+struct zpool *zpool_create( int npages, int maxbytes )
+{
+	struct zpool *zp = malloc(sizeof(*zp));
+	if (!zp) return 0;
+
+	zp->entries = calloc(npages, sizeof(struct zentry));
+	zp->scratch = malloc(PAGE_SIZE);
+	if (!zp->entries || !zp->scratch) {
+		free(zp->entries);
+		free(zp->scratch);
+		free(zp);
+		return 0;
+	}
+
+	zp->npages = npages;
+	zp->maxbytes = maxbytes;
+	zp->usedbytes = 0;
+	zp->stores = 0;
+	zp->loads = 0;
+	zp->rejectsFull = 0;
+	zp->rejectsBig = 0;
+
+	return zp;
+}
+
+/* zpool_store()
+ * Try to keep a compressed copy of "data" as the contents of "page".
+ * Returns 1 if the page is now in the pool, 0 if it has to go to disk instead
+ * 	(either it did not compress well enough or the pool is full).
+ */
+int zpool_store( struct zpool *zp, int page, const char *data )
+{
+	// whatever was stored for this page before is out of date now
+	zpool_invalidate(zp, page);
+
+	int len = zpool_compress((const unsigned char *)data, (unsigned char *)zp->scratch, ZPOOL_MAX_LEN);
+	if (len < 0) {
+		++zp->rejectsBig;
+		return 0;
+	}
+	if (zp->usedbytes + len > zp->maxbytes) {
+		++zp->rejectsFull;
+		return 0;
+	}
+
+	char *copy = malloc(len);
+	if (!copy) {
+		++zp->rejectsFull;
+		return 0;
+	}
+	memcpy(copy, zp->scratch, len);
+
+	zp->entries[page].data = copy;
+	zp->entries[page].len = len;
+	zp->usedbytes += len;
+	++zp->stores;
+
+	return 1;
+}
+
+/* zpool_load()
+ * If "page" is in the pool, decompress it into "data" and return 1, otherwise return 0.
+ * The entry stays in the pool so a clean page can be dropped again without a write.
+ */
+int zpool_load( struct zpool *zp, int page, char *data )
+{
+	struct zentry *e = &zp->entries[page];
+	if (!e->data) return 0;
+
+	zpool_decompress((const unsigned char *)e->data, e->len, (unsigned char *)data);
+	++zp->loads;
+
+	return 1;
+}
+
+/* zpool_invalidate()
+ * Drop the pool's copy of "page", if there is one. Must be called as soon as the
+ * 	page in memory is written to, since the copy is no longer current.
+ */
+void zpool_invalidate( struct zpool *zp, int page )
+{
+	struct zentry *e = &zp->entries[page];
+	if (!e->data) return;
+
+	zp->usedbytes -= e->len;
+	free(e->data);
+	e->data = NULL;
+	e->len = 0;
+}
+
+/* zpool_print_stats()
+ * Print how much disk traffic the pool absorbed.
+ */
+void zpool_print_stats( struct zpool *zp )
+{
+	printf("pool hits: %d\npool stores: %d\npool rejects (incompressible): %d\npool rejects (full): %d\npool bytes: %d/%d\n",
+		zp->loads, zp->stores, zp->rejectsBig, zp->rejectsFull, zp->usedbytes, zp->maxbytes);
+}
+
+/* zpool_delete()
+ * Free the pool and everything stored in it.
+ */
+void zpool_delete( struct zpool *zp )
+{
+	int i;
+	for (i = 0; i < zp->npages; ++i) free(zp->entries[i].data);
+	free(zp->entries);
+	free(zp->scratch);
+	free(zp);
+}
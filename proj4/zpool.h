@@ -0,0 +1,13 @@
+#ifndef ZPOOL_H
+#define ZPOOL_H
+
+struct zpool;
+
+struct zpool *zpool_create( int npages, int maxbytes );
+int zpool_store( struct zpool *zp, int page, const char *data );
+int zpool_load( struct zpool *zp, int page, char *data );
+void zpool_invalidate( struct zpool *zp, int page );
+void zpool_print_stats( struct zpool *zp );
+void zpool_delete( struct zpool *zp );
+
+#endif